@@ -0,0 +1,76 @@
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include "alloc_counter.h"
+
+#if defined(LAB3_COUNT_ALLOCS)
+
+namespace {
+
+std::atomic<long> count(0);
+
+void* counted_alloc(std::size_t size) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    for (;;) {
+        void* p = std::malloc(size ? size : 1);
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* counted_alloc_nothrow(std::size_t size) noexcept {
+    try {
+        return counted_alloc(size);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+}
+
+long heap_allocations() {
+    return count.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    return counted_alloc(size);
+}
+
+void* operator new[](std::size_t size) {
+    return counted_alloc(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc_nothrow(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc_nothrow(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#else
+
+long heap_allocations() {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __ALLOC_COUNTER_H__
+#define __ALLOC_COUNTER_H__
+
+// Built with LAB3_COUNT_ALLOCS defined, alloc_counter.cpp replaces the global operator new and every
+// call through it (from any thread) is counted. Compare two readings to see whether a piece of code
+// touched the heap. Other builds keep the standard allocator and heap_allocations() returns -1.
+long heap_allocations();
+
+#endif //__ALLOC_COUNTER_H__
@@ -0,0 +1,72 @@
+#include <cstdlib>
+#include <algorithm>
+#include "arena.h"
+
+Arena::Arena(size_t capacity) : blocks_(), offset_(0), total_(0) {
+    Block b = { static_cast<char*>(std::malloc(capacity)), capacity };
+    if (!b.data) throw std::bad_alloc();
+    blocks_.reserve(8);
+    blocks_.push_back(b);
+}
+
+Arena::~Arena() {
+    for (size_t i = 0; i < blocks_.size(); i++) std::free(blocks_[i].data);
+}
+
+size_t Arena::capacity() const {
+    size_t n = 0;
+    for (size_t i = 0; i < blocks_.size(); i++) n += blocks_[i].size;
+    return n;
+}
+
+void* Arena::allocate(size_t bytes, size_t align) {
+    Block& b = blocks_.back();
+    size_t start = (reinterpret_cast<size_t>(b.data) + offset_ + align - 1) / align * align - reinterpret_cast<size_t>(b.data);
+    if (start + bytes > b.size) {
+        Block next = { nullptr, std::max(bytes + align, b.size * 2) };
+        next.data = static_cast<char*>(std::malloc(next.size));
+        if (!next.data) throw std::bad_alloc();
+        blocks_.push_back(next);
+        offset_ = 0;
+        return allocate(bytes, align);
+    }
+    offset_ = start + bytes;
+    total_ += bytes;
+    return b.data + start;
+}
+
+void Arena::reset() {
+    if (blocks_.size() > 1) {
+        size_t size = capacity();
+        for (size_t i = 0; i < blocks_.size(); i++) std::free(blocks_[i].data);
+        blocks_.clear();
+        Block b = { static_cast<char*>(std::malloc(size)), size };
+        if (!b.data) throw std::bad_alloc();
+        blocks_.push_back(b);
+    }
+    offset_ = 0;
+    total_ = 0;
+}
+
+FrameArenas::FrameArenas(ThreadPool& pool) : pool_(pool), arenas_(), outside_mutex_(), outside_() {
+    arenas_.push_back(std::unique_ptr<Arena>());
+    for (int i = 1; i < pool.size(); i++) arenas_.push_back(std::unique_ptr<Arena>(new Arena()));
+}
+
+Arena& FrameArenas::local() {
+    int index = pool_.thread_index();
+    if (index > 0) return *arenas_[index];
+    std::thread::id self = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(outside_mutex_);
+    for (size_t i = 0; i < outside_.size(); i++) {
+        if (outside_[i].first == self) return *outside_[i].second;
+    }
+    outside_.push_back(std::make_pair(self, std::unique_ptr<Arena>(new Arena())));
+    return *outside_.back().second;
+}
+
+void FrameArenas::reset() {
+    for (size_t i = 1; i < arenas_.size(); i++) arenas_[i]->reset();
+    std::lock_guard<std::mutex> lock(outside_mutex_);
+    for (size_t i = 0; i < outside_.size(); i++) outside_[i].second->reset();
+}
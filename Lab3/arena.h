@@ -0,0 +1,64 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "thread_pool.h"
+
+// Linear allocator for data that lives for one frame. Nothing is freed individually, reset() drops
+// everything at once. A frame that overflows the block chains a new one; the next reset() merges them
+// into a single block of the total size, so from the second frame on a steady workload never touches
+// the heap.
+class Arena {
+public:
+    explicit Arena(size_t capacity = 1 << 16);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+    void reset();
+    size_t used() const { return total_; }
+    size_t capacity() const;
+
+    // Default-constructed array; the destructors are never run, so only trivially destructible types.
+    template <class T>
+    T* allocate_array(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        T* p = static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < n; i++) new (p + i) T();
+        return p;
+    }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;  // the last one is being filled
+    size_t offset_;              // in the last block
+    size_t total_;               // bytes handed out since the last reset
+};
+
+// One arena per thread, so that tasks allocate without locking. Pool workers are found by index.
+// Threads outside the pool all share index 0, and several of them may run tasks of the same frame
+// while they wait on their own, so each gets an arena of its own on first use, looked up by thread id.
+class FrameArenas {
+public:
+    explicit FrameArenas(ThreadPool& pool);
+    Arena& local();
+    void reset();
+private:
+    ThreadPool& pool_;
+    std::vector<std::unique_ptr<Arena> > arenas_;  // by worker index, [0] unused
+    std::mutex outside_mutex_;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<Arena> > > outside_;
+};
+
+#endif //__ARENA_H__
@@ -0,0 +1,144 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <stdio.h>
+#include "batch.h"
+#include "image_writer.h"
+#include "video_writer.h"
+
+RenderJob::RenderJob() : output("output.tga"), width(800), height(800), eye(0.f, 0.f, 5.f), target(0.f, 0.f, 0.f),
+    up(0.f, 1.f, 0.f), fov(60.f), light_dir(1.f, -1.f, 1.f) {
+}
+
+Camera RenderJob::camera() const {
+    return Camera(eye, target, up, fov, (float)width / (float)height, 0.1f, 100.f);
+}
+
+bool parse_job(const std::string& line, RenderJob& job, std::string& error) {
+    std::istringstream iss(line);
+    job = RenderJob();
+    if (!(iss >> job.output)) {
+        error = "missing output path";
+        return false;
+    }
+    std::string key;
+    while (iss >> key) {
+        bool ok;
+        if (key == "size") {
+            std::string size;
+            ok = (iss >> size) && sscanf(size.c_str(), "%dx%d", &job.width, &job.height) == 2 && job.width > 0 && job.height > 0 &&
+                job.width <= 0xffff && job.height <= 0xffff;
+        }
+        else if (key == "eye") ok = (bool)(iss >> job.eye.x >> job.eye.y >> job.eye.z);
+        else if (key == "target") ok = (bool)(iss >> job.target.x >> job.target.y >> job.target.z);
+        else if (key == "up") ok = (bool)(iss >> job.up.x >> job.up.y >> job.up.z);
+        else if (key == "fov") ok = (bool)(iss >> job.fov) && job.fov > 0.f && job.fov < 180.f;
+        else if (key == "light") ok = (bool)(iss >> job.light_dir.x >> job.light_dir.y >> job.light_dir.z);
+        else {
+            error = "unknown key " + key;
+            return false;
+        }
+        if (!ok) {
+            error = "bad value for " + key;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_jobs(const char* filename, std::vector<RenderJob>& jobs) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "can't open manifest " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int n = 1; std::getline(in, line); n++) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') continue;
+        RenderJob job;
+        std::string error;
+        if (!parse_job(line, job, error)) {
+            std::cerr << filename << ":" << n << ": " << error << std::endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.;
+    size_t rank = (size_t)std::ceil(p / 100. * values.size());
+    rank = std::min(values.size(), std::max((size_t)1, rank));
+    std::nth_element(values.begin(), values.begin() + (rank - 1), values.end());
+    return values[rank - 1];
+}
+
+int run_batch(Model& model, ThreadPool& pool, CompactMesh* mesh, const RenderOptions& options,
+    const std::vector<RenderJob>& jobs, int lanes, int writers, const char* video, int fps) {
+    if (jobs.empty()) {
+        std::cerr << "# batch has no jobs, nothing to render" << (video ? " or encode" : "") << std::endl;
+        return 0;
+    }
+    lanes = std::max(1, std::min(lanes, (int)jobs.size()));
+    std::unique_ptr<ImageWriter> images;
+    std::unique_ptr<VideoWriter> stream;
+    if (video) {
+        for (size_t j = 1; j < jobs.size(); j++) {
+            if (jobs[j].width == jobs[0].width && jobs[j].height == jobs[0].height) continue;
+            std::cerr << "job " << j + 1 << " is " << jobs[j].width << "x" << jobs[j].height << ", a video needs every frame "
+                << jobs[0].width << "x" << jobs[0].height << std::endl;
+            return (int)jobs.size();
+        }
+        stream.reset(new VideoWriter(jobs[0].width, jobs[0].height, VideoWriter::format_for(video), fps, lanes + 1));
+        if (!stream->open(video)) return (int)jobs.size();
+        writers = 1;
+    }
+    else images.reset(new ImageWriter(writers, lanes + 1, &pool));
+    std::vector<std::unique_ptr<Renderer> > renderers;
+    for (int i = 0; i < lanes; i++) renderers.push_back(std::unique_ptr<Renderer>(new Renderer(model, pool, mesh, options)));
+
+    std::vector<double> latency(jobs.size());
+    std::atomic<int> next(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < lanes; i++) {
+        Renderer* renderer = renderers[i].get();
+        threads.push_back(std::thread([&, renderer] {
+            for (int j = next++; j < (int)jobs.size(); j = next++) {
+                std::chrono::steady_clock::time_point job_start = std::chrono::steady_clock::now();
+                const RenderJob& job = jobs[j];
+                renderer->resize(job.width, job.height);
+                renderer->set_camera(job.camera());
+                renderer->set_light(job.light_dir);
+                renderer->render();
+                if (stream) stream->submit(j, renderer->image());
+                else images->submit(renderer->image(), job.output);
+                std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - job_start;
+                latency[j] = ms.count();
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+    if (stream) stream->finish();
+    else images->finish();
+    std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+    ImageWriter::Stats written = stream ? stream->stats() : images->stats();
+
+    std::cerr << "# batch " << jobs.size() << " jobs on " << lanes << " lanes x " << pool.size() << " threads in "
+        << total.count() << " s, " << jobs.size() / total.count() << " frames/s" << std::endl;
+    std::cerr << "# job latency ms, until handed to the writer: p50 " << percentile(latency, 50.) << ", p90 " << percentile(latency, 90.)
+        << ", p99 " << percentile(latency, 99.) << ", max " << percentile(latency, 100.) << std::endl;
+    // the share of encode+write time the lanes did not spend waiting for a buffer
+    double overlap = written.busy_ms > 0. ? std::max(0., 1. - written.stall_ms / written.busy_ms) : 1.;
+    std::cerr << "# writer: " << written.busy_ms << " ms encoding on " << std::max(1, writers) << " threads, lanes stalled "
+        << written.stall_ms << " ms, " << overlap * 100. << "% overlapped" << std::endl;
+    return written.failed;
+}
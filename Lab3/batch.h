@@ -0,0 +1,48 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+#include "model.h"
+#include "compact_mesh.h"
+#include "renderer.h"
+#include "thread_pool.h"
+
+// One frame of a batch. Written in a manifest as one line:
+//   <output.tga> [size WxH] [eye x y z] [target x y z] [up x y z] [fov degrees] [light x y z]
+// Omitted keys keep the defaults of a plain Lab3 run. A size is at most 65535 on a side, as in a TGA file.
+struct RenderJob {
+    std::string output;
+    int width;
+    int height;
+    Vec3f eye;
+    Vec3f target;
+    Vec3f up;
+    float fov;
+    Vec3f light_dir;
+    RenderJob();
+    Camera camera() const;
+};
+
+// Parses one manifest line; on failure `error` says why.
+bool parse_job(const std::string& line, RenderJob& job, std::string& error);
+
+// Reads a manifest, skipping blank lines and # comments.
+bool load_jobs(const char* filename, std::vector<RenderJob>& jobs);
+
+// Value below which `p` percent of `values` fall, nearest rank.
+double percentile(std::vector<double> values, double p);
+
+// Renders every job over the one loaded model. Each of `lanes` threads owns a Renderer and takes
+// the next job as soon as it has handed its last frame to the writer, so small frames render side by
+// side while the pool still splits each frame, and encoding overlaps rendering. Buffers are reused
+// between jobs. `writers` threads encode with `lanes` + 1 buffers in flight. Prints throughput, latency
+// percentiles and how much of the writing was hidden; returns the number of jobs that failed to write.
+// With `video`, the frames go into that one stream (see VideoWriter) in manifest order instead of
+// their own files; every job must then have the size of the first.
+int run_batch(Model& model, ThreadPool& pool, CompactMesh* mesh, const RenderOptions& options,
+    const std::vector<RenderJob>& jobs, int lanes, int writers = 1, const char* video = nullptr, int fps = 25);
+
+#endif //__BATCH_H__
@@ -0,0 +1,547 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <string.h>
+#include "bench.h"
+#include "shader.h"
+#include "camera.h"
+#include "thread_pool.h"
+#include "renderer.h"
+#include "video_writer.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Stores a result the benchmark doesn't otherwise use, so the loop computing it stays.
+template <typename T>
+void do_not_optimize(const T& value) {
+    volatile T sink = value;
+    (void)sink;
+}
+
+// Random barycentric coordinates, 8 per batch.
+std::vector<FragmentBatch> random_batches(int nbatches) {
+    std::vector<FragmentBatch> batches(nbatches);
+    srand(1);
+    for (int b = 0; b < nbatches; b++) {
+        for (int i = 0; i < 8; i++) {
+            float u = rand() / (float)RAND_MAX;
+            float v = rand() / (float)RAND_MAX * (1.f - u);
+            batches[b].bar[0][i] = u;
+            batches[b].bar[1][i] = v;
+            batches[b].bar[2][i] = 1.f - u - v;
+            batches[b].x[i] = batches[b].y[i] = 0;
+            batches[b].z[i] = 0.f;
+        }
+        batches[b].count = 8;
+    }
+    return batches;
+}
+
+// Mfrag/s of scalar fragment() (batched == false) or fragment8() over the batches.
+double shade_throughput(const PhongShader& shader, const Varyings& in, const std::vector<FragmentBatch>& batches, bool batched, unsigned long& checksum) {
+    TGAColor colors[8];
+    Clock::time_point start = Clock::now();
+    for (int b = 0; b < (int)batches.size(); b++) {
+        if (batched) shader.fragment8(in, batches[b], colors);
+        for (int i = 0; i < 8; i++) {
+            if (!batched) shader.fragment(in, Vec3f(batches[b].bar[0][i], batches[b].bar[1][i], batches[b].bar[2][i]), colors[i]);
+            checksum += colors[i].bgra[0];
+        }
+    }
+    return batches.size() * 8. / (elapsed_ms(start) * 1e3);
+}
+
+void bench_fragment(Model& model) {
+    Matrix id = Matrix::identity();
+    PhongShader shader(model, id, id, id, Vec3f(1.f, -1.f, 1.f), Vec3f(0.f, 0.f, 5.f), Vec3f(), 1.f);
+    Varyings in = Varyings();
+    for (int j = 0; j < 3; j++) shader.vertex(0, j, in);
+
+    std::vector<FragmentBatch> batches = random_batches(1 << 17);
+    unsigned long scalar_sum = 0, batch_sum = 0;
+    double scalar = shade_throughput(shader, in, batches, false, scalar_sum);
+    double batched = shade_throughput(shader, in, batches, true, batch_sum);
+    std::cout << "fragment scalar  " << scalar << " Mfrag/s" << std::endl;
+    std::cout << "fragment8        " << batched << " Mfrag/s (x" << batched / scalar << ")" << std::endl;
+    std::cout << "checksum delta   " << (long)(scalar_sum - batch_sum) << std::endl;
+}
+
+void bench_specular(Model& model) {
+    const int n = 1 << 20;
+    std::vector<float> xs(n);
+    for (int i = 0; i < n; i++) xs[i] = (i + .5f) / n;
+
+    Matrix id = Matrix::identity();
+    PhongShader shader(model, id, id, id, Vec3f(1.f, -1.f, 1.f), Vec3f(0.f, 0.f, 5.f), Vec3f(), 1.f);
+    Varyings in = Varyings();
+    for (int j = 0; j < 3; j++) shader.vertex(0, j, in);
+    std::vector<FragmentBatch> batches = random_batches(1 << 17);
+
+    double base_eval = 0., base_scalar = 0., base_batched = 0.;
+    for (int m = SPECULAR_POW; m <= SPECULAR_EXP2; m++) {
+        SpecularPower spec(32.f, (SpecularMode)m);
+        float max_err = 0.f;
+        for (int i = 0; i < n; i++) max_err = std::max(max_err, std::fabs(spec(xs[i]) - std::pow(xs[i], 32.f)));
+
+        float sum = 0.f;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < n; i += 8) sum += spec(float8::load(&xs[i])).first();
+        double eval = n / (elapsed_ms(start) * 1e3);
+
+        shader.uniform_specular = spec;
+        unsigned long checksum = (unsigned long)sum;
+        double scalar = shade_throughput(shader, in, batches, false, checksum);
+        double batched = shade_throughput(shader, in, batches, true, checksum);
+        if (m == SPECULAR_POW) {
+            base_eval = eval;
+            base_scalar = scalar;
+            base_batched = batched;
+        }
+        std::cout << SpecularPower::name((SpecularMode)m) << "\tmax error " << max_err
+            << "\teval x8 " << eval << " M/s (x" << eval / base_eval << ")"
+            << "\tfragment " << scalar << " (x" << scalar / base_scalar << ")"
+            << "\tfragment8 " << batched << " Mfrag/s (x" << batched / base_batched << ")" << std::endl;
+        do_not_optimize(checksum);
+    }
+}
+
+
+// Model vertices through a matrix and normalized, Vec4f/Vec3f one at a time vs Vec4x8/Vec3x8,
+// then 4x4 matrix products.
+void bench_math(Model& model) {
+    const int n = 1 << 20;
+    std::vector<float> xs(n), ys(n), zs(n);
+    for (int i = 0; i < n; i++) {
+        Vec3f v = model.vert(i % model.nverts());
+        xs[i] = v.x;
+        ys[i] = v.y;
+        zs[i] = v.z + 3.f;
+    }
+    Matrix m = Matrix::identity();
+    m[0][1] = .3f;
+    m[1][2] = -.2f;
+    m[3][2] = -1.f / 5.f;
+    std::vector<float> out(n);
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < n; i++) {
+        Vec4f r = m * Vec4f(xs[i], ys[i], zs[i]);
+        out[i] = Vec3f(r.x, r.y, r.z).normalize().x / r.w;
+    }
+    double scalar = n / (elapsed_ms(start) * 1e3);
+    float checksum = out[n / 3];
+
+    double mode[2];
+    float max_err[2] = { 0.f, 0.f };
+    for (int fast = 0; fast < 2; fast++) {
+        std::vector<float> batch(n);
+        start = Clock::now();
+        for (int i = 0; i < n; i += 8) {
+            Vec4x8 r = m * Vec4x8(Vec3x8::load(&xs[i], &ys[i], &zs[i]));
+            Vec3x8 v(r.x, r.y, r.z);
+            v = fast ? normalize_fast(v) : normalize(v);
+            (v.x / r.w).store(&batch[i]);
+        }
+        mode[fast] = n / (elapsed_ms(start) * 1e3);
+        for (int i = 0; i < n; i++) max_err[fast] = std::max(max_err[fast], std::fabs(batch[i] - out[i]));
+    }
+    std::cout << "transform+normalize scalar   " << scalar << " M/s" << std::endl;
+    std::cout << "transform+normalize x8       " << mode[0] << " M/s (x" << mode[0] / scalar << "), max error " << max_err[0] << std::endl;
+    std::cout << "transform+normalize_fast x8  " << mode[1] << " M/s (x" << mode[1] / scalar << "), max error " << max_err[1] << std::endl;
+    do_not_optimize(checksum);
+
+    // chained 4x4 products, as when building a per-object MVP
+    const int nmat = 1 << 20;
+    Matrix a = m, b = m;
+    start = Clock::now();
+    for (int i = 0; i < nmat; i++) a = (a * m) * Matrix::identity();
+    double unrolled = nmat / (elapsed_ms(start) * 1e3);
+    start = Clock::now();
+    for (int i = 0; i < nmat; i++) b = multiply_simd(multiply_simd(b, m), Matrix::identity());
+    double simd = nmat / (elapsed_ms(start) * 1e3);
+    std::cout << "matrix product unrolled      " << unrolled * 2 << " M/s" << std::endl;
+    std::cout << "matrix product simd          " << simd * 2 << " M/s (x" << simd / unrolled << ")" << std::endl;
+    do_not_optimize(a[0][0] + b[0][0]);
+}
+
+
+// Vertex stage + rasterization of one 800x800 frame on pools of 1..32 threads, unpinned and pinned.
+void bench_scaling(Model& model) {
+    const int size = 800;
+    double base[2] = { 0., 0. };
+    std::cout << "threads\tframe ms\tspeedup\tpinned ms\tspeedup" << std::endl;
+    for (int threads = 1; threads <= 32; threads *= 2) {
+        double best[2];
+        for (int pin = 0; pin < 2; pin++) {
+            ThreadPool pool(threads, pin != 0);
+            Renderer renderer(model, pool);
+            renderer.resize(size, size);
+            renderer.set_camera(Renderer::default_camera(size, size));
+            best[pin] = 1e30;
+            for (int rep = 0; rep < 5; rep++) {
+                renderer.render();
+                best[pin] = std::min(best[pin], renderer.frame_ms());
+            }
+            if (threads == 1) base[pin] = best[pin];
+        }
+        std::cout << threads << "\t" << best[0] << "\tx" << base[0] / best[0] << "\t" << best[1] << "\tx" << base[1] / best[1] << std::endl;
+    }
+    std::cout << "hardware threads " << std::thread::hardware_concurrency() << std::endl;
+}
+
+// 1..8 renderers drawing 400x400 frames at once, each on its own thread, over one model and one pool.
+void bench_renderers(Model& model) {
+    const int size = 400;
+    const int frames = 8;
+    ThreadPool pool;
+    std::cout << "renderers\tframes/s" << std::endl;
+    for (int n = 1; n <= 8; n *= 2) {
+        std::vector<std::unique_ptr<Renderer> > renderers;
+        for (int i = 0; i < n; i++) {
+            renderers.push_back(std::unique_ptr<Renderer>(new Renderer(model, pool)));
+            renderers[i]->resize(size, size);
+            Camera camera = Renderer::default_camera(size, size);
+            camera.setPosition(Vec3f(std::sin(i * .5f) * 5.f, 0.f, std::cos(i * .5f) * 5.f));
+            renderers[i]->set_camera(camera);
+        }
+        Clock::time_point start = Clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < n; i++) {
+            Renderer* r = renderers[i].get();
+            threads.push_back(std::thread([r] {
+                for (int f = 0; f < frames; f++) r->render();
+            }));
+        }
+        for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+        std::cout << n << "\t" << n * frames / (elapsed_ms(start) * 1e-3) << std::endl;
+    }
+}
+
+TGAImage noise_image(int w, int h, int bpp) {
+    TGAImage img(w, h, bpp);
+    srand(1);
+    for (int y = 0; y < h; y++) {
+        unsigned char* row = img.row(y);
+        for (int i = 0; i < w * bpp; i++) row[i] = (unsigned char)rand();
+    }
+    return img;
+}
+
+// Best of 5 runs of `op` on a fresh copy of `src`, in ms.
+template <class Op>
+double time_image_op(const TGAImage& src, Op op) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; rep++) {
+        TGAImage img(src);
+        Clock::time_point start = Clock::now();
+        op(img);
+        best = std::min(best, elapsed_ms(start));
+    }
+    return best;
+}
+
+void report_image_op(const char* name, double bulk, double per_pixel, size_t bytes) {
+    std::cout << name << "\t" << bulk << "\t" << bytes / (bulk * 1e6) << "\t" << per_pixel << "\tx" << per_pixel / bulk << std::endl;
+}
+
+// Bulk TGAImage operations on a 4K frame against the same operation written with get/set.
+void bench_image() {
+    const int w = 3840, h = 2160;
+    TGAImage gray = noise_image(w, h, TGAImage::GRAYSCALE);
+    TGAImage rgb = noise_image(w, h, TGAImage::RGB);
+    TGAImage rgba = noise_image(w, h, TGAImage::RGBA);
+    size_t npixels = (size_t)w * h;
+    std::cout << "operation\tbulk ms\tGB/s\tget/set ms\tspeedup" << std::endl;
+
+    TGAColor color(10, 20, 30);
+    report_image_op("fill rgb", time_image_op(rgb, [&](TGAImage& img) { img.fill(color); }),
+        time_image_op(rgb, [&](TGAImage& img) {
+            for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) img.set(x, y, color);
+        }), npixels * 3);
+    TGAImage dst(w, h, TGAImage::RGB);
+    report_image_op("blit rgb", time_image_op(dst, [&](TGAImage& img) { img.blit(rgb, 0, 0, w, h, 0, 0); }),
+        time_image_op(dst, [&](TGAImage& img) {
+            for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) img.set(x, y, rgb.get(x, y));
+        }), npixels * 3 * 2);
+    report_image_op("flip_v rgb", time_image_op(rgb, [](TGAImage& img) { img.flip_vertically(); }),
+        time_image_op(rgb, [&](TGAImage& img) {
+            for (int y = 0; y < h / 2; y++) for (int x = 0; x < w; x++) {
+                TGAColor a = img.get(x, y);
+                img.set(x, y, img.get(x, h - 1 - y));
+                img.set(x, h - 1 - y, a);
+            }
+        }), npixels * 3 * 2);
+    const char* flip_names[3] = { "flip_h gray", "flip_h rgb", "flip_h rgba" };
+    TGAImage* images[3] = { &gray, &rgb, &rgba };
+    for (int k = 0; k < 3; k++) {
+        report_image_op(flip_names[k], time_image_op(*images[k], [](TGAImage& img) { img.flip_horizontally(); }),
+            time_image_op(*images[k], [&](TGAImage& img) {
+                for (int y = 0; y < h; y++) for (int x = 0; x < w / 2; x++) {
+                    TGAColor a = img.get(x, y);
+                    img.set(x, y, img.get(w - 1 - x, y));
+                    img.set(w - 1 - x, y, a);
+                }
+            }), npixels * images[k]->get_bytespp() * 2);
+    }
+    const int bgr_rgb[4] = { 2, 1, 0, 3 };
+    for (int k = 1; k < 3; k++) {
+        report_image_op(k == 1 ? "swizzle rgb" : "swizzle rgba", time_image_op(*images[k], [&](TGAImage& img) { img.swizzle(bgr_rgb); }),
+            time_image_op(*images[k], [&](TGAImage& img) {
+                for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) {
+                    TGAColor c = img.get(x, y);
+                    std::swap(c.bgra[0], c.bgra[2]);
+                    img.set(x, y, c);
+                }
+            }), npixels * images[k]->get_bytespp() * 2);
+    }
+    struct Conversion { const char* name; TGAImage* from; TGAImage::Format to; };
+    Conversion conversions[4] = { { "rgb->rgba", &rgb, TGAImage::RGBA }, { "rgba->rgb", &rgba, TGAImage::RGB },
+        { "gray->rgb", &gray, TGAImage::RGB }, { "rgb->gray", &rgb, TGAImage::GRAYSCALE } };
+    for (int k = 0; k < 4; k++) {
+        Conversion cv = conversions[k];
+        report_image_op(cv.name, time_image_op(*cv.from, [&](TGAImage& img) { img.convert(cv.to); }),
+            time_image_op(*cv.from, [&](TGAImage& img) {
+                TGAImage out(w, h, cv.to);
+                for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) {
+                    TGAColor c = img.get(x, y);
+                    if (c.bytespp == 1) c = TGAColor(c.bgra[0], c.bgra[0], c.bgra[0]);
+                    else if (cv.to == TGAImage::GRAYSCALE) c = TGAColor((unsigned char)((29 * c.bgra[0] + 150 * c.bgra[1] + 77 * c.bgra[2] + 128) >> 8));
+                    else if (c.bytespp == 3) c.bgra[3] = 255;
+                    out.set(x, y, c);
+                }
+                img = out;
+            }), npixels * (cv.from->get_bytespp() + (int)cv.to));
+    }
+}
+
+// The decoder as it was before: one stream call per packet and per pixel, then a flip pass.
+bool stream_decode(std::istream& in, TGAImage& img) {
+    TGA_Header header;
+    if (!in.read((char*)&header, sizeof(header))) return false;
+    int w = header.width, h = header.height, bpp = header.bitsperpixel >> 3;
+    img = TGAImage(w, h, bpp);
+    unsigned char* data = img.buffer();
+    if (header.datatypecode == 2 || header.datatypecode == 3) {
+        if (!in.read((char*)data, (size_t)w * h * bpp)) return false;
+    }
+    else {
+        unsigned long pixelcount = (unsigned long)w * h, currentpixel = 0, currentbyte = 0;
+        unsigned char pixel[4];
+        while (currentpixel < pixelcount) {
+            int chunkheader = in.get();
+            if (!in.good()) return false;
+            int n = (chunkheader & 127) + 1;
+            if (chunkheader >= 128) in.read((char*)pixel, bpp);
+            for (int i = 0; i < n && currentpixel < pixelcount; i++, currentpixel++) {
+                if (chunkheader < 128) in.read((char*)pixel, bpp);
+                if (!in.good()) return false;
+                for (int t = 0; t < bpp; t++) data[currentbyte++] = pixel[t];
+            }
+        }
+    }
+    if (!(header.imagedescriptor & 0x20)) img.flip_vertically();
+    return true;
+}
+
+// The RLE encoder as it was before: serial, one stream call per packet, and a literal packet broken
+// by any two equal pixels.
+void stream_encode(std::ostream& out, TGAImage& img) {
+    const unsigned char* data = img.buffer();
+    int bytespp = img.get_bytespp();
+    unsigned long npixels = (unsigned long)img.get_width() * img.get_height();
+    unsigned long curpix = 0;
+    while (curpix < npixels) {
+        unsigned long chunkstart = curpix * bytespp;
+        unsigned long curbyte = curpix * bytespp;
+        unsigned char run_length = 1;
+        bool raw = true;
+        while (curpix + run_length < npixels && run_length < 128) {
+            bool succ_eq = true;
+            for (int t = 0; succ_eq && t < bytespp; t++) succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
+            curbyte += bytespp;
+            if (1 == run_length) raw = !succ_eq;
+            if (raw && succ_eq) {
+                run_length--;
+                break;
+            }
+            if (!raw && !succ_eq) break;
+            run_length++;
+        }
+        curpix += run_length;
+        out.put(raw ? run_length - 1 : run_length + 127);
+        out.write((const char*)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
+    }
+}
+
+// RLE encoding of a rendered 4K and 8K frame and of the model's textures: the old serial encoder,
+// the band encoder on one thread and on the pool. Sizes are of the pixel data.
+void bench_tga_encode(Model& model, ThreadPool& pool) {
+    std::vector<std::pair<std::string, TGAImage> > images;
+    const int sizes[2][2] = { { 3840, 2160 }, { 7680, 4320 } };
+    for (int k = 0; k < 2; k++) {
+        Renderer renderer(model, pool);
+        renderer.resize(sizes[k][0], sizes[k][1]);
+        renderer.set_camera(Renderer::default_camera(sizes[k][0], sizes[k][1]));
+        renderer.render();
+        images.push_back(std::make_pair(std::string(k ? "8K frame" : "4K frame"), renderer.image()));
+    }
+    std::shared_ptr<TGAImage> maps[3] = { model.diffuse_map(0), model.normal_map(0), model.specular_map(0) };
+    const char* map_names[3] = { "diffuse", "normal", "specular" };
+    for (int k = 0; k < 3; k++) if (maps[k]) images.push_back(std::make_pair(std::string(map_names[k]), *maps[k]));
+    std::cout << "image\told KB\tnew KB\told ms\t1 thread ms\t" << pool.size() << " threads ms\tspeedup" << std::endl;
+    for (size_t i = 0; i < images.size(); i++) {
+        TGAImage& img = images[i].second;
+        size_t old_size = 0, new_size = 0;
+        double old_ms = 1e30, one_ms = 1e30, pool_ms = 1e30;
+        for (int rep = 0; rep < 3; rep++) {
+            std::ostringstream a, b, c;
+            Clock::time_point start = Clock::now();
+            stream_encode(a, img);
+            old_ms = std::min(old_ms, elapsed_ms(start));
+            start = Clock::now();
+            img.write_tga(b, true);
+            one_ms = std::min(one_ms, elapsed_ms(start));
+            start = Clock::now();
+            img.write_tga(c, true, &pool);
+            pool_ms = std::min(pool_ms, elapsed_ms(start));
+            old_size = a.str().size();
+            new_size = b.str().size() - sizeof(TGA_Header) - 26;
+            TGAImage back;
+            std::string bytes = c.str();
+            if (rep == 0 && (!back.read_tga((const unsigned char*)bytes.data(), bytes.size()) ||
+                memcmp(back.buffer(), img.buffer(), (size_t)img.get_width() * img.get_height() * img.get_bytespp())))
+                std::cout << "# " << images[i].first << ": round trip differs" << std::endl;
+        }
+        std::cout << images[i].first << "\t" << old_size / 1024 << "\t" << new_size / 1024 << "\t" << old_ms << "\t" << one_ms
+            << "\t" << pool_ms << "\tx" << old_ms / pool_ms << std::endl;
+    }
+}
+
+// Decode throughput of the model's texture files and of a 4K frame, RLE and raw, from memory:
+// the whole-buffer decoder against the per-packet stream decoder.
+void bench_tga(Model& model) {
+    struct Input { std::string name; std::string bytes; };
+    std::vector<Input> inputs;
+    for (int m = 0; m < model.nmaterials(); m++) {
+        const std::string paths[3] = { model.material(m).diffuse_path, model.material(m).normal_path, model.material(m).specular_path };
+        for (int k = 0; k < 3; k++) {
+            std::ifstream in(paths[k].c_str(), std::ios::binary);
+            if (paths[k].empty() || !in) continue;
+            std::ostringstream bytes;
+            bytes << in.rdbuf();
+            inputs.push_back(Input{ paths[k], bytes.str() });
+        }
+    }
+    ThreadPool pool;
+    Renderer renderer(model, pool);
+    renderer.resize(3840, 2160);
+    renderer.set_camera(Renderer::default_camera(3840, 2160));
+    renderer.render();
+    for (int rle = 1; rle >= 0; rle--) {
+        std::ostringstream out;
+        renderer.image().write_tga(out, rle != 0);
+        inputs.push_back(Input{ rle ? "4K frame, rle" : "4K frame, raw", out.str() });
+    }
+    std::cout << "file	KB	decode ms	MB/s out	stream ms	speedup" << std::endl;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const std::string& bytes = inputs[i].bytes;
+        TGAImage img;
+        double fast = 1e30, slow = 1e30;
+        for (int rep = 0; rep < 5; rep++) {
+            Clock::time_point start = Clock::now();
+            if (!img.read_tga((const unsigned char*)bytes.data(), bytes.size())) break;
+            fast = std::min(fast, elapsed_ms(start));
+        }
+        size_t decoded = (size_t)img.get_width() * img.get_height() * img.get_bytespp();
+        for (int rep = 0; rep < 5; rep++) {
+            std::istringstream in(bytes);
+            TGAImage ref;
+            Clock::time_point start = Clock::now();
+            if (!stream_decode(in, ref)) break;
+            slow = std::min(slow, elapsed_ms(start));
+            if (rep == 0 && (ref.get_width() != img.get_width() || memcmp(ref.buffer(), img.buffer(), decoded)))
+                std::cout << "# " << inputs[i].name << ": decoders disagree" << std::endl;
+        }
+        std::cout << inputs[i].name << "\t" << bytes.size() / 1024 << "\t" << fast << "\t" << decoded / (fast * 1e3)
+            << "\t" << slow << "\tx" << slow / fast << std::endl;
+    }
+    std::cout << std::endl;
+    bench_tga_encode(model, pool);
+}
+
+// RGB -> YUV 4:2:0 of a rendered 4K frame against the same conversion written with get(), plus the
+// rgb24 path of the raw video output (swizzle in place).
+void bench_yuv(Model& model) {
+    const int w = 3840, h = 2160;
+    ThreadPool pool;
+    Renderer renderer(model, pool);
+    renderer.resize(w, h);
+    renderer.set_camera(Renderer::default_camera(w, h));
+    renderer.render();
+    TGAImage frame = renderer.image();
+    int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    std::vector<unsigned char> fast((size_t)w * h + 2 * (size_t)cw * ch), slow(fast.size());
+    std::cout << "operation\tbulk ms\tGB/s\tget/set ms\tspeedup" << std::endl;
+    double bulk = time_image_op(frame, [&](TGAImage& img) { rgb_to_yuv420(img, fast.data()); });
+    double per_pixel = time_image_op(frame, [&](TGAImage& img) {
+        unsigned char* u = slow.data() + (size_t)w * h;
+        unsigned char* v = u + (size_t)cw * ch;
+        for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) {
+            TGAColor c = img.get(x, y);
+            slow[(size_t)y * w + x] = (unsigned char)((29 * c.bgra[0] + 150 * c.bgra[1] + 77 * c.bgra[2] + 128) >> 8);
+        }
+        for (int y = 0; y < ch; y++) for (int x = 0; x < cw; x++) {
+            int sum[3] = { 0, 0, 0 };
+            for (int k = 0; k < 4; k++) {
+                TGAColor c = img.get(std::min(x * 2 + k % 2, w - 1), std::min(y * 2 + k / 2, h - 1));
+                for (int t = 0; t < 3; t++) sum[t] += c.bgra[t];
+            }
+            int b = (sum[0] + 2) >> 2, g = (sum[1] + 2) >> 2, r = (sum[2] + 2) >> 2;
+            u[y * cw + x] = (unsigned char)((127 * b - 84 * g - 43 * r + 32896) >> 8);
+            v[y * cw + x] = (unsigned char)((-21 * b - 106 * g + 127 * r + 32896) >> 8);
+        }
+    });
+    report_image_op("rgb->yuv420", bulk, per_pixel, (size_t)w * h * 3 + fast.size());
+    if (fast != slow) std::cout << "# yuv planes differ" << std::endl;
+    const int bgr_rgb[4] = { 2, 1, 0, 3 };
+    report_image_op("rgb24", time_image_op(frame, [&](TGAImage& img) { img.swizzle(bgr_rgb); }),
+        time_image_op(frame, [&](TGAImage& img) {
+            for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) {
+                TGAColor c = img.get(x, y);
+                std::swap(c.bgra[0], c.bgra[2]);
+                img.set(x, y, c);
+            }
+        }), (size_t)w * h * 3 * 2);
+}
+}
+
+bool run_benchmark(const char* name, Model& model) {
+    if (!model.nfaces()) {
+        std::cerr << "benchmarks need a model with faces" << std::endl;
+        return false;
+    }
+    if (!strcmp(name, "fragment")) bench_fragment(model);
+    else if (!strcmp(name, "specular")) bench_specular(model);
+    else if (!strcmp(name, "math")) bench_math(model);
+    else if (!strcmp(name, "scaling")) bench_scaling(model);
+    else if (!strcmp(name, "renderers")) bench_renderers(model);
+    else if (!strcmp(name, "image")) bench_image();
+    else if (!strcmp(name, "tga")) bench_tga(model);
+    else if (!strcmp(name, "yuv")) bench_yuv(model);
+    else return false;
+    return true;
+}
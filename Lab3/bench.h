@@ -0,0 +1,10 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "model.h"
+
+// Micro-benchmarks of single pipeline pieces, run as `Lab3 --bench <name> [model.obj]`.
+// Returns false for an unknown name.
+bool run_benchmark(const char* name, Model& model);
+
+#endif //__BENCH_H__
@@ -51,18 +51,11 @@ Matrix Camera::viewMatrix() const {
 }
 
 Matrix Camera::projectionMatrix() const {
-    Matrix proj = Matrix::identity();
-
     //   FOV:   ,   ""
     float fovRad = m_fovY * float(M_PI) / 180.f;
     float s = 1.f / std::tan(fovRad * 0.5f);  //  "scale"  FOV
 
-    proj[0][0] = s;
-    proj[1][1] = s;
-
     //    tinyRenderer-    Z/W
     float dist = (m_position - m_target).norm();
-    proj[3][2] = -1.f / dist;
-
-    return proj;
+    return Matrix::projection(s, dist, m_aspect);
 }
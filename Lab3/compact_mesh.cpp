@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include "compact_mesh.h"
+
+namespace {
+
+// Open-addressing slot of the weld table: an attribute tuple (position / uv / normal indices) and
+// the compact vertex made from it, -1 when empty.
+struct WeldSlot {
+    Vec3i key;
+    int vert;
+};
+
+size_t weld_hash(const Vec3i& key) {
+    return (size_t)key.x * 73856093u ^ (size_t)key.y * 19349663u ^ (size_t)key.z * 83492791u;
+}
+
+// Slot holding `key`, or the empty one where it goes. `slots` is a power of two, never full.
+size_t weld_find(const std::vector<WeldSlot>& slots, const Vec3i& key) {
+    size_t mask = slots.size() - 1;
+    size_t i = weld_hash(key) & mask;
+    while (slots[i].vert >= 0) {
+        const Vec3i& k = slots[i].key;
+        if (k.x == key.x && k.y == key.y && k.z == key.z) break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+unsigned short quantize(float v, float lo, float step) {
+    float q = step > 0.f ? (v - lo) / step + 0.5f : 0.f;
+    return (unsigned short)std::min(65535.f, std::max(0.f, q));
+}
+
+short snorm16(float v) {
+    v = std::min(1.f, std::max(-1.f, v));
+    return (short)std::floor(v * 32767.f + 0.5f);
+}
+
+float sign_not_zero(float v) {
+    return v >= 0.f ? 1.f : -1.f;
+}
+
+}
+
+// Welded with a hash table sized by the distinct vertices rather than a sorted copy of every corner,
+// and the indices are written once, so building adds little to the model it is made from.
+CompactMesh::CompactMesh(Model& model) : verts_(), indices16_(), indices32_(), ranges_(), pos_min_(), pos_max_(), pos_step_(),
+    uv_min_(), uv_step_() {
+    Vec3f pmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vec3f pmax = pmin * -1.f;
+    for (int i = 0; i < model.nverts(); i++) {
+        Vec3f v = model.vert(i);
+        for (int k = 0; k < 3; k++) {
+            pmin[k] = std::min(pmin[k], v[k]);
+            pmax[k] = std::max(pmax[k], v[k]);
+        }
+    }
+
+    // uv bounds and triangle count of the fan triangulation
+    Vec2f umin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vec2f umax = umin * -1.f;
+    size_t ntris = 0;
+    for (int i = 0; i < model.nfaces(); i++) {
+        int n = model.face_size(i);
+        if (n < 3) continue;
+        ntris += n - 2;
+        for (int k = 0; k < n; k++) {
+            Vec2f t = model.texcoord(model.corner(i, k).y);
+            umin = Vec2f(std::min(umin.x, t.x), std::min(umin.y, t.y));
+            umax = Vec2f(std::max(umax.x, t.x), std::max(umax.y, t.y));
+        }
+    }
+    if (!ntris) {
+        pmin = pmax = Vec3f();
+        umin = umax = Vec2f();
+    }
+
+    pos_min_ = pmin;
+    pos_max_ = pmax;
+    pos_step_ = (pmax - pmin) * (1.f / 65535.f);
+    uv_min_ = umin;
+    uv_step_ = (umax - umin) * (1.f / 65535.f);
+
+    // fan-triangulate, welding identical tuples as they come
+    WeldSlot empty = { Vec3i(), -1 };
+    std::vector<WeldSlot> slots(1024, empty);
+    indices32_.reserve(ntris * 3);
+    for (int r = 0; r < model.nranges(); r++) {
+        MaterialRange src = model.range(r);
+        MaterialRange dst = { src.material, (int)indices32_.size() / 3, 0 };
+        for (int i = src.first; i < src.first + src.count; i++) {
+            int corners = model.face_size(i);
+            for (int k = 1; k + 1 < corners; k++) {
+                int fan[3] = { 0, k, k + 1 };
+                for (int j = 0; j < 3; j++) {
+                    Vec3i key = model.corner(i, fan[j]);
+                    size_t slot = weld_find(slots, key);
+                    if (slots[slot].vert < 0) {
+                        Vec3f p = model.vert(key.x);
+                        Vec2f t = model.texcoord(key.y);
+                        Vec3f n = model.normal(key.z);
+                        CompactVertex cv;
+                        for (int c = 0; c < 3; c++) cv.pos[c] = quantize(p[c], pos_min_[c], pos_step_[c]);
+                        cv.uv[0] = quantize(t.x, uv_min_.x, uv_step_.x);
+                        cv.uv[1] = quantize(t.y, uv_min_.y, uv_step_.y);
+                        float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+                        Vec2f o = l1 > 0.f ? Vec2f(n.x / l1, n.y / l1) : Vec2f();
+                        if (n.z < 0.f)
+                            o = Vec2f((1.f - std::fabs(o.y)) * sign_not_zero(o.x), (1.f - std::fabs(o.x)) * sign_not_zero(o.y));
+                        cv.normal[0] = snorm16(o.x);
+                        cv.normal[1] = snorm16(o.y);
+                        cv.pad = 0;
+                        slots[slot].key = key;
+                        slots[slot].vert = (int)verts_.size();
+                        verts_.push_back(cv);
+                        // kept at most half full
+                        if (verts_.size() * 2 > slots.size()) {
+                            std::vector<WeldSlot> grown(slots.size() * 2, empty);
+                            for (size_t s = 0; s < slots.size(); s++)
+                                if (slots[s].vert >= 0) grown[weld_find(grown, slots[s].key)] = slots[s];
+                            slots.swap(grown);
+                            slot = weld_find(slots, key);
+                        }
+                    }
+                    indices32_.push_back((unsigned int)slots[slot].vert);
+                }
+            }
+        }
+        dst.count = (int)indices32_.size() / 3 - dst.first;
+        if (dst.count) ranges_.push_back(dst);
+    }
+
+    if (verts_.size() <= 65536) {
+        indices16_.assign(indices32_.begin(), indices32_.end());
+        std::vector<unsigned int>().swap(indices32_);
+    }
+}
+
+int CompactMesh::nverts() {
+    return (int)verts_.size();
+}
+
+int CompactMesh::nfaces() {
+    return (int)(indices16_.size() + indices32_.size()) / 3;
+}
+
+int CompactMesh::nranges() {
+    return (int)ranges_.size();
+}
+
+MaterialRange CompactMesh::range(int i) {
+    return ranges_[i];
+}
+
+int CompactMesh::index(int iface, int nthvert) {
+    int i = iface * 3 + nthvert;
+    return indices32_.empty() ? indices16_[i] : (int)indices32_[i];
+}
+
+Vec3f CompactMesh::vert(int i) {
+    const unsigned short* q = verts_[i].pos;
+    return Vec3f(pos_min_.x + q[0] * pos_step_.x, pos_min_.y + q[1] * pos_step_.y, pos_min_.z + q[2] * pos_step_.z);
+}
+
+Vec3f CompactMesh::norm(int i) {
+    Vec3f n(verts_[i].normal[0] / 32767.f, verts_[i].normal[1] / 32767.f, 0.f);
+    n.z = 1.f - std::fabs(n.x) - std::fabs(n.y);
+    float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return n.normalize();
+}
+
+Vec2f CompactMesh::uv(int i) {
+    return Vec2f(uv_min_.x + verts_[i].uv[0] * uv_step_.x, uv_min_.y + verts_[i].uv[1] * uv_step_.y);
+}
+
+void CompactMesh::bounds(Vec3f& lo, Vec3f& hi) {
+    lo = pos_min_;
+    hi = pos_max_;
+}
+
+size_t CompactMesh::bytes() {
+    return verts_.size() * sizeof(CompactVertex) + indices16_.size() * sizeof(unsigned short) + indices32_.size() * sizeof(unsigned int);
+}
@@ -0,0 +1,44 @@
+#ifndef __COMPACT_MESH_H__
+#define __COMPACT_MESH_H__
+
+#include <vector>
+#include <cstddef>
+#include "geometry.h"
+#include "model.h"
+
+// 16 bytes per vertex instead of 32 bytes of floats plus a Vec3i per corner.
+struct CompactVertex {
+    unsigned short pos[3];  // unorm16 relative to the model AABB
+    unsigned short uv[2];   // unorm16 relative to the uv AABB
+    short normal[2];        // octahedron encoding, snorm16
+    unsigned short pad;
+};
+
+// Quantized, welded and triangulated copy of a Model. Attributes are decoded in the vertex stage.
+class CompactMesh {
+private:
+    std::vector<CompactVertex> verts_;
+    std::vector<unsigned short> indices16_;  // used when nverts <= 65536
+    std::vector<unsigned int> indices32_;
+    std::vector<MaterialRange> ranges_;
+    Vec3f pos_min_;
+    Vec3f pos_max_;
+    Vec3f pos_step_;
+    Vec2f uv_min_;
+    Vec2f uv_step_;
+public:
+    CompactMesh(Model& model);
+    int nverts();
+    int nfaces();
+    int nranges();
+    MaterialRange range(int i);
+    int index(int iface, int nthvert);
+    Vec3f vert(int i);
+    Vec3f norm(int i);
+    Vec2f uv(int i);
+    // Bounding box of the model's positions before quantization.
+    void bounds(Vec3f& lo, Vec3f& hi);
+    size_t bytes();
+};
+
+#endif //__COMPACT_MESH_H__
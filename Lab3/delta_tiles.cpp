@@ -0,0 +1,212 @@
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+#include "delta_tiles.h"
+
+namespace {
+
+// Streams past 2 GB need 64-bit offsets, which fseek's long doesn't hold on Windows.
+int seek(FILE* f, long long offset, int whence) {
+#if defined(_WIN32)
+    return _fseeki64(f, offset, whence);
+#else
+    return fseeko(f, (off_t)offset, whence);
+#endif
+}
+
+}
+
+// Multiply / xor-shift over 8-byte words. Both steps are invertible, so two tiles differing in a
+// single word never collide.
+unsigned long long hash_tile(TGAImage& image, int x, int y, int w, int h) {
+    const unsigned long long k = 0x9E3779B97F4A7C15ull;
+    int bpp = image.get_bytespp();
+    size_t bytes = (size_t)w * bpp;
+    unsigned long long hash = k ^ (bytes * h);
+    for (int j = 0; j < h; j++) {
+        const unsigned char* p = image.row(y + j) + (size_t)x * bpp;
+        for (size_t i = 0; i < bytes; i += 8) {
+            unsigned long long word = 0;
+            memcpy(&word, p + i, std::min((size_t)8, bytes - i));
+            hash = (hash ^ word) * k;
+            hash ^= hash >> 29;
+        }
+    }
+    return hash;
+}
+
+TileDeltaWriter::TileDeltaWriter(FILE* out, int width, int height, int tile, int keyframe_interval) : out_(out), header_(),
+    tiles_x_(0), tiles_y_(0), ok_(true), hashes_(), offsets_(), ids_(), changed_(), payload_(), stats_(), start_() {
+    memcpy(header_.magic, "LAB3DLT1", 8);
+    header_.width = width;
+    header_.height = height;
+    header_.bytespp = 0;
+    header_.tile = std::max(1, tile);
+    header_.keyframe_interval = std::max(1, keyframe_interval);
+    tiles_x_ = (width + header_.tile - 1) / header_.tile;
+    tiles_y_ = (height + header_.tile - 1) / header_.tile;
+    stats_.frames = 0;
+    stats_.tiles = stats_.tiles_stored = 0;
+    stats_.bytes = stats_.full_bytes = 0;
+}
+
+bool TileDeltaWriter::write(const void* bytes, size_t size) {
+    if (ok_ && size && fwrite(bytes, 1, size, out_) != size) ok_ = false;
+    stats_.bytes += size;
+    return ok_;
+}
+
+bool TileDeltaWriter::begin(int bytespp) {
+    header_.bytespp = bytespp;
+    start_ = std::chrono::steady_clock::now();
+    return write(&header_, sizeof(header_));
+}
+
+bool TileDeltaWriter::add(TGAImage& frame) {
+    if (frame.get_width() != (int)header_.width || frame.get_height() != (int)header_.height ||
+        (stats_.frames && frame.get_bytespp() != (int)header_.bytespp)) {
+        std::cerr << "frame doesn't match the tile stream" << std::endl;
+        return false;
+    }
+    if (!stats_.frames) begin(frame.get_bytespp());
+    int bpp = header_.bytespp, tile = header_.tile;
+    bool key = stats_.frames % header_.keyframe_interval == 0;
+    hashes_.resize(tiles_x_ * tiles_y_);
+    payload_.reserve((size_t)header_.width * header_.height * bpp);
+    ids_.clear();
+    changed_.clear();
+    payload_.clear();
+    for (int ty = 0; ty < tiles_y_; ty++) {
+        for (int tx = 0; tx < tiles_x_; tx++) {
+            int x = tx * tile, y = ty * tile;
+            int w = std::min(tile, (int)header_.width - x), h = std::min(tile, (int)header_.height - y);
+            int id = ty * tiles_x_ + tx;
+            unsigned long long hash = hash_tile(frame, x, y, w, h);
+            if (!key && hashes_[id] == hash) continue;
+            hashes_[id] = hash;
+            ids_.push_back(id);
+            changed_.push_back(hash);
+            for (int j = 0; j < h; j++) {
+                const unsigned char* p = frame.row(y + j) + (size_t)x * bpp;
+                payload_.insert(payload_.end(), p, p + (size_t)w * bpp);
+            }
+        }
+    }
+    offsets_.push_back(stats_.bytes);
+    unsigned int n = (unsigned int)ids_.size();
+    write(&n, sizeof(n));
+    write(ids_.data(), n * sizeof(unsigned int));
+    write(changed_.data(), n * sizeof(unsigned long long));
+    write(payload_.data(), payload_.size());
+    stats_.frames++;
+    stats_.tiles += tiles_x_ * tiles_y_;
+    stats_.tiles_stored += n;
+    stats_.full_bytes += sizeof(TGA_Header) + (size_t)header_.width * header_.height * bpp + 26;
+    if (!ok_) std::cerr << "can't write the tile stream" << std::endl;
+    return ok_;
+}
+
+bool TileDeltaWriter::finish() {
+    if (!stats_.frames) begin(TGAImage::RGB);
+    unsigned int n = (unsigned int)offsets_.size();
+    write(offsets_.data(), n * sizeof(unsigned long long));
+    write(&n, sizeof(n));
+    write("LAB3DIDX", 8);
+    std::chrono::duration<double> s = std::chrono::steady_clock::now() - start_;
+    const double mb = 1024. * 1024.;
+    double saved = stats_.full_bytes > stats_.bytes ? (stats_.full_bytes - stats_.bytes) / mb : 0.;
+    std::cerr << "# tiles: " << stats_.frames << " frames, " << stats_.tiles_stored << " of " << stats_.tiles << " tiles stored ("
+        << (stats_.tiles ? 100. * stats_.tiles_stored / stats_.tiles : 0.) << "%), " << stats_.bytes / mb << " MB vs "
+        << stats_.full_bytes / mb << " MB as raw TGA files, ratio " << stats_.full_bytes / (double)stats_.bytes << ":1, "
+        << saved << " MB not written (" << saved / std::max(1e-9, s.count()) << " MB/s)" << std::endl;
+    return ok_;
+}
+
+TileDeltaReader::TileDeltaReader() : in_(nullptr), header_(), tiles_x_(0), tiles_y_(0), offsets_(), current_(), current_index_(-1) {}
+
+TileDeltaReader::~TileDeltaReader() {
+    if (in_) fclose(in_);
+}
+
+bool TileDeltaReader::open(const char* filename) {
+    in_ = fopen(filename, "rb");
+    if (!in_) {
+        std::cerr << "can't open file " << filename << std::endl;
+        return false;
+    }
+    int bpp = 0;
+    if (fread(&header_, sizeof(header_), 1, in_) == 1 && !memcmp(header_.magic, "LAB3DLT1", 8)) bpp = header_.bytespp;
+    if ((bpp != TGAImage::GRAYSCALE && bpp != TGAImage::RGB && bpp != TGAImage::RGBA) || !header_.width || !header_.height ||
+        !header_.tile || !header_.keyframe_interval) {
+        std::cerr << filename << " is not a tile delta stream" << std::endl;
+        return false;
+    }
+    tiles_x_ = (header_.width + header_.tile - 1) / header_.tile;
+    tiles_y_ = (header_.height + header_.tile - 1) / header_.tile;
+    unsigned int n = 0;
+    char magic[8];
+    if (seek(in_, -12, SEEK_END) || fread(&n, sizeof(n), 1, in_) != 1 || fread(magic, 8, 1, in_) != 1 ||
+        memcmp(magic, "LAB3DIDX", 8) || seek(in_, -12 - (long long)n * 8, SEEK_END)) {
+        std::cerr << filename << ": the frame index is missing" << std::endl;
+        return false;
+    }
+    offsets_.resize(n);
+    if (n && fread(offsets_.data(), sizeof(unsigned long long), n, in_) != n) {
+        std::cerr << filename << ": the frame index is truncated" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TileDeltaReader::read(int index, TGAImage& out) {
+    if (!in_ || index < 0 || index >= frames()) return false;
+    int key = index - index % header_.keyframe_interval;
+    if (current_index_ < key || current_index_ > index) {
+        current_ = TGAImage(header_.width, header_.height, header_.bytespp);
+        current_index_ = key - 1;
+    }
+    while (current_index_ < index) {
+        if (!apply(current_index_ + 1)) {
+            current_index_ = -1;
+            return false;
+        }
+        current_index_++;
+    }
+    out = current_;
+    return true;
+}
+
+// Reads frame `index`'s tiles over current_ and checks them against their hashes.
+bool TileDeltaReader::apply(int index) {
+    unsigned int n = 0;
+    if (seek(in_, (long long)offsets_[index], SEEK_SET) || fread(&n, sizeof(n), 1, in_) != 1 || n > (unsigned int)(tiles_x_ * tiles_y_)) {
+        std::cerr << "frame " << index << " is damaged" << std::endl;
+        return false;
+    }
+    std::vector<unsigned int> ids(n);
+    std::vector<unsigned long long> hashes(n);
+    if ((n && fread(ids.data(), sizeof(unsigned int), n, in_) != n) || (n && fread(hashes.data(), sizeof(unsigned long long), n, in_) != n)) {
+        std::cerr << "frame " << index << " is truncated" << std::endl;
+        return false;
+    }
+    int bpp = header_.bytespp, tile = header_.tile;
+    for (unsigned int k = 0; k < n; k++) {
+        if (ids[k] >= (unsigned int)(tiles_x_ * tiles_y_)) {
+            std::cerr << "frame " << index << " is damaged" << std::endl;
+            return false;
+        }
+        int x = ids[k] % tiles_x_ * tile, y = ids[k] / tiles_x_ * tile;
+        int w = std::min(tile, (int)header_.width - x), h = std::min(tile, (int)header_.height - y);
+        for (int j = 0; j < h; j++) {
+            if (fread(current_.row(y + j) + (size_t)x * bpp, (size_t)w * bpp, 1, in_) != 1) {
+                std::cerr << "frame " << index << " is truncated" << std::endl;
+                return false;
+            }
+        }
+        if (hash_tile(current_, x, y, w, h) != hashes[k]) {
+            std::cerr << "tile " << ids[k] << " of frame " << index << " doesn't match its hash" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef __DELTA_TILES_H__
+#define __DELTA_TILES_H__
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <chrono>
+#include "tgaimage.h"
+
+// Frame sequence storing only the tiles that changed since the previous frame. Little-endian layout:
+//   header  "LAB3DLT1", u32 width, height, bytespp, tile size, keyframe interval
+//   frame   u32 n, u32 tile ids[n], u64 tile hashes[n], then the n tiles' pixels, rows top to bottom
+//   index   u64 offset of every frame, u32 frame count, "LAB3DIDX"
+// Tiles are numbered row by row; edge tiles are cut to the image. Every keyframe-interval-th frame
+// stores all tiles, so a frame is rebuilt from the last keyframe before it.
+struct DeltaHeader {
+    char magic[8];
+    unsigned int width;
+    unsigned int height;
+    unsigned int bytespp;
+    unsigned int tile;
+    unsigned int keyframe_interval;
+};
+
+class TileDeltaWriter {
+public:
+    struct Stats {
+        int frames;
+        long tiles;          // summed over the frames
+        long tiles_stored;
+        size_t bytes;        // written so far
+        size_t full_bytes;   // the same frames as uncompressed TGA files
+    };
+
+    // Writes to `out`, which stays open. A tile whose 64-bit hash matches the one at the same place in
+    // the previous frame is taken as unchanged.
+    TileDeltaWriter(FILE* out, int width, int height, int tile = 32, int keyframe_interval = 64);
+    bool add(TGAImage& frame);
+    // Writes the index and prints the compression report.
+    bool finish();
+    Stats stats() const { return stats_; }
+
+private:
+    bool write(const void* bytes, size_t size);
+    bool begin(int bytespp);
+
+    FILE* out_;
+    DeltaHeader header_;
+    int tiles_x_;
+    int tiles_y_;
+    bool ok_;
+    std::vector<unsigned long long> hashes_;  // of the previous frame
+    std::vector<unsigned long long> offsets_;
+    std::vector<unsigned int> ids_;
+    std::vector<unsigned long long> changed_;
+    std::vector<unsigned char> payload_;
+    Stats stats_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class TileDeltaReader {
+public:
+    TileDeltaReader();
+    ~TileDeltaReader();
+    bool open(const char* filename);
+    int frames() const { return (int)offsets_.size(); }
+    int width() const { return header_.width; }
+    int height() const { return header_.height; }
+    // Rebuilds frame `index`; going forward from the last frame read only applies the frames between.
+    bool read(int index, TGAImage& out);
+
+private:
+    bool apply(int index);
+
+    FILE* in_;
+    DeltaHeader header_;
+    int tiles_x_;
+    int tiles_y_;
+    std::vector<unsigned long long> offsets_;
+    TGAImage current_;
+    int current_index_;  // frame held by current_, -1 for none
+};
+
+// 64-bit hash of the w x h pixel block at (x, y).
+unsigned long long hash_tile(TGAImage& image, int x, int y, int w, int h);
+
+#endif //__DELTA_TILES_H__
@@ -6,14 +6,14 @@
 template <class t>
 struct Vec2 {
     t x, y;
-    Vec2() : x(t()), y(t()) {}
-    Vec2(t _x, t _y) : x(_x), y(_y) {}
-    t& operator[](int i) { return (i == 0 ? x : y); }
-    const t& operator[](int i) const { return (i == 0 ? x : y); }
-
-    Vec2<t> operator+(const Vec2<t>& v) const { return Vec2<t>(x + v.x, y + v.y); }
-    Vec2<t> operator-(const Vec2<t>& v) const { return Vec2<t>(x - v.x, y - v.y); }
-    Vec2<t> operator*(float f) const { return Vec2<t>(x * f, y * f); }
+    constexpr Vec2() : x(t()), y(t()) {}
+    constexpr Vec2(t _x, t _y) : x(_x), y(_y) {}
+    constexpr t& operator[](int i) { return (i == 0 ? x : y); }
+    constexpr const t& operator[](int i) const { return (i == 0 ? x : y); }
+
+    constexpr Vec2<t> operator+(const Vec2<t>& v) const { return Vec2<t>(x + v.x, y + v.y); }
+    constexpr Vec2<t> operator-(const Vec2<t>& v) const { return Vec2<t>(x - v.x, y - v.y); }
+    constexpr Vec2<t> operator*(float f) const { return Vec2<t>(x * f, y * f); }
 };
 
 typedef Vec2<float> Vec2f;
@@ -23,22 +23,22 @@ template <class t>
 struct Vec3 {
     t x, y, z;
 
-    Vec3() : x(t()), y(t()), z(t()) {}
-    Vec3(t _x, t _y, t _z) : x(_x), y(_y), z(_z) {}
+    constexpr Vec3() : x(t()), y(t()), z(t()) {}
+    constexpr Vec3(t _x, t _y, t _z) : x(_x), y(_y), z(_z) {}
 
-    t& operator[](int i) { return (i == 0 ? x : (i == 1 ? y : z)); }
-    const t& operator[](int i) const { return (i == 0 ? x : (i == 1 ? y : z)); }
+    constexpr t& operator[](int i) { return (i == 0 ? x : (i == 1 ? y : z)); }
+    constexpr const t& operator[](int i) const { return (i == 0 ? x : (i == 1 ? y : z)); }
 
     template <class u>
     Vec3(const Vec3<u>& v) : x(static_cast<t>(v.x)), y(static_cast<t>(v.y)), z(static_cast<t>(v.z)) {}
 
-    Vec3<t> operator+(const Vec3<t>& v) const { return Vec3<t>(x + v.x, y + v.y, z + v.z); }
-    Vec3<t> operator-(const Vec3<t>& v) const { return Vec3<t>(x - v.x, y - v.y, z - v.z); }
-    Vec3<t> operator*(float f) const { return Vec3<t>(x * f, y * f, z * f); }
+    constexpr Vec3<t> operator+(const Vec3<t>& v) const { return Vec3<t>(x + v.x, y + v.y, z + v.z); }
+    constexpr Vec3<t> operator-(const Vec3<t>& v) const { return Vec3<t>(x - v.x, y - v.y, z - v.z); }
+    constexpr Vec3<t> operator*(float f) const { return Vec3<t>(x * f, y * f, z * f); }
 
-    t operator*(const Vec3<t>& v) const { return x * v.x + y * v.y + z * v.z; }
+    constexpr t operator*(const Vec3<t>& v) const { return x * v.x + y * v.y + z * v.z; }
 
-    Vec3<t> operator^(const Vec3<t>& v) const {
+    constexpr Vec3<t> operator^(const Vec3<t>& v) const {
         return Vec3<t>(
             y * v.z - z * v.y,
             z * v.x - x * v.z,
@@ -64,38 +64,58 @@ typedef Vec3<int>   Vec3i;
 
 struct Vec4f {
     float x, y, z, w;
-    Vec4f() : x(0.f), y(0.f), z(0.f), w(1.f) {}
-    Vec4f(float _x, float _y, float _z, float _w = 1.f) : x(_x), y(_y), z(_z), w(_w) {}
+    constexpr Vec4f() : x(0.f), y(0.f), z(0.f), w(1.f) {}
+    constexpr Vec4f(float _x, float _y, float _z, float _w = 1.f) : x(_x), y(_y), z(_z), w(_w) {}
 };
 
+// Fully constexpr: a matrix built from constants is evaluated at compile time, as the checks below
+// show. The renderer's viewport and projection depend on the frame size and are built at run time.
 struct Matrix {
     float m[4][4];
 
-    Matrix() {
-        for (int i = 0; i < 4; i++)
-            for (int j = 0; j < 4; j++)
-                m[i][j] = 0.f;
-    }
+    constexpr Matrix() : m{} {}
 
-    static Matrix identity(int dim = 4) {
+    static constexpr Matrix identity(int dim = 4) {
         Matrix r;
         for (int i = 0; i < dim && i < 4; i++) r.m[i][i] = 1.f;
         return r;
     }
 
-    float* operator[](int i) { return m[i]; }
-    const float* operator[](int i) const { return m[i]; }
+    // Maps [-1,1]^2 to the x,y,w,h rectangle and [-1,1] to [0,depth]. Image rows go top to bottom, as
+    // TGA files store them, so y = 1 lands on row y and y = -1 on row y + h.
+    static constexpr Matrix viewport(int x, int y, int w, int h, int depth) {
+        Matrix r = identity();
+        r.m[0][0] = w / 2.f;
+        r.m[0][3] = x + w / 2.f;
+        r.m[1][1] = -h / 2.f;
+        r.m[1][3] = y + h / 2.f;
+        r.m[2][2] = depth / 2.f;
+        r.m[2][3] = depth / 2.f;
+        return r;
+    }
+
+    // Perspective with the eye `dist` away from the origin along +z, y scaled by `s` and x by `s / aspect`.
+    static constexpr Matrix projection(float s, float dist, float aspect = 1.f) {
+        Matrix r = identity();
+        r.m[0][0] = s / aspect;
+        r.m[1][1] = s;
+        r.m[3][2] = -1.f / dist;
+        return r;
+    }
 
-    Matrix operator*(const Matrix& o) const {
+    constexpr float* operator[](int i) { return m[i]; }
+    constexpr const float* operator[](int i) const { return m[i]; }
+
+    // Unrolled over k; same summation order as the textbook triple loop.
+    constexpr Matrix operator*(const Matrix& o) const {
         Matrix r;
         for (int i = 0; i < 4; i++)
             for (int j = 0; j < 4; j++)
-                for (int k = 0; k < 4; k++)
-                    r.m[i][j] += m[i][k] * o.m[k][j];
+                r.m[i][j] = m[i][0] * o.m[0][j] + m[i][1] * o.m[1][j] + m[i][2] * o.m[2][j] + m[i][3] * o.m[3][j];
         return r;
     }
 
-    Vec4f operator*(const Vec4f& v) const {
+    constexpr Vec4f operator*(const Vec4f& v) const {
         Vec4f r;
         r.x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3] * v.w;
         r.y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3] * v.w;
@@ -105,4 +125,12 @@ struct Matrix {
     }
 };
 
+// The viewport maps the NDC corners to the image corners, top-left first, and composes with identity.
+static_assert((Matrix::viewport(0, 0, 800, 600, 255) * Vec4f(-1.f, 1.f, -1.f)).x == 0.f &&
+    (Matrix::viewport(0, 0, 800, 600, 255) * Vec4f(-1.f, 1.f, -1.f)).y == 0.f &&
+    (Matrix::viewport(0, 0, 800, 600, 255) * Vec4f(1.f, -1.f, 1.f)).y == 600.f &&
+    (Matrix::viewport(0, 0, 800, 600, 255) * Vec4f(1.f, -1.f, 1.f)).z == 255.f, "viewport corners");
+static_assert((Matrix::identity() * Matrix::viewport(0, 0, 800, 600, 255))[0][3] == 400.f &&
+    (Matrix::viewport(0, 0, 800, 600, 255) * Matrix::identity())[1][1] == -300.f, "identity composition");
+
 #endif
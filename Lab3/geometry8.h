@@ -0,0 +1,94 @@
+#ifndef __GEOMETRY8_H__
+#define __GEOMETRY8_H__
+
+#include "geometry.h"
+#include "simd.h"
+
+// Batch companions of geometry.h: 8 vectors in SoA form, one float8 per component.
+
+struct Vec3x8 {
+    float8 x, y, z;
+    Vec3x8() : x(), y(), z() {}
+    Vec3x8(const float8& _x, const float8& _y, const float8& _z) : x(_x), y(_y), z(_z) {}
+    explicit Vec3x8(const Vec3f& v) : x(v.x), y(v.y), z(v.z) {}
+
+    static Vec3x8 load(const float* xs, const float* ys, const float* zs) {
+        return Vec3x8(float8::load(xs), float8::load(ys), float8::load(zs));
+    }
+    void store(float* xs, float* ys, float* zs) const {
+        x.store(xs);
+        y.store(ys);
+        z.store(zs);
+    }
+
+    Vec3x8 operator+(const Vec3x8& v) const { return Vec3x8(x + v.x, y + v.y, z + v.z); }
+    Vec3x8 operator-(const Vec3x8& v) const { return Vec3x8(x - v.x, y - v.y, z - v.z); }
+    Vec3x8 operator*(const float8& f) const { return Vec3x8(x * f, y * f, z * f); }
+};
+
+struct Vec4x8 {
+    float8 x, y, z, w;
+    Vec4x8() : x(), y(), z(), w(1.f) {}
+    Vec4x8(const float8& _x, const float8& _y, const float8& _z, const float8& _w) : x(_x), y(_y), z(_z), w(_w) {}
+    explicit Vec4x8(const Vec3x8& v, const float8& _w = float8(1.f)) : x(v.x), y(v.y), z(v.z), w(_w) {}
+};
+
+inline float8 dot(const Vec3x8& a, const Vec3x8& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec3x8 cross(const Vec3x8& a, const Vec3x8& b) {
+    return Vec3x8(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+// Same as Vec3f::normalize: vectors shorter than 1e-6 are left alone.
+inline Vec3x8 normalize(const Vec3x8& v) {
+    float8 len = sqrt(dot(v, v));
+    float8 ok = len > float8(1e-6f);
+    return Vec3x8(select(ok, v.x / len, v.x), select(ok, v.y / len, v.y), select(ok, v.z / len, v.z));
+}
+
+// One rsqrt and three multiplies instead of a sqrt and three divides, ~1e-6 relative error.
+inline Vec3x8 normalize_fast(const Vec3x8& v) {
+    float8 len2 = dot(v, v);
+    float8 inv = select(len2 > float8(1e-12f), rsqrt(len2), float8(1.f));
+    return v * inv;
+}
+
+// Barycentric interpolation of three per-vertex values.
+inline Vec3x8 interpolate(const Vec3f* v, const float8& b0, const float8& b1, const float8& b2) {
+    return Vec3x8(float8(v[0].x) * b0 + float8(v[1].x) * b1 + float8(v[2].x) * b2,
+        float8(v[0].y) * b0 + float8(v[1].y) * b1 + float8(v[2].y) * b2,
+        float8(v[0].z) * b0 + float8(v[1].z) * b1 + float8(v[2].z) * b2);
+}
+
+// Matrix times 8 column vectors, the matrix entries are broadcast once per call.
+inline Vec4x8 operator*(const Matrix& m, const Vec4x8& v) {
+    Vec4x8 r;
+    float8* out[4] = { &r.x, &r.y, &r.z, &r.w };
+    for (int i = 0; i < 4; i++)
+        *out[i] = float8(m[i][0]) * v.x + float8(m[i][1]) * v.y + float8(m[i][2]) * v.z + float8(m[i][3]) * v.w;
+    return r;
+}
+
+// Matrix product with one SSE register per row: row i of a*b is sum_k a[i][k] * b.row(k).
+// Same summation order as Matrix::operator*, without FMA contraction the results are identical.
+inline Matrix multiply_simd(const Matrix& a, const Matrix& b) {
+#if defined(LAB3_SIMD_AVX) || defined(LAB3_SIMD_SSE2)
+    __m128 rows[4];
+    for (int k = 0; k < 4; k++) rows[k] = _mm_loadu_ps(b.m[k]);
+    Matrix r;
+    for (int i = 0; i < 4; i++) {
+        __m128 s = _mm_mul_ps(_mm_set1_ps(a.m[i][0]), rows[0]);
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(a.m[i][1]), rows[1]));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(a.m[i][2]), rows[2]));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(a.m[i][3]), rows[3]));
+        _mm_storeu_ps(r.m[i], s);
+    }
+    return r;
+#else
+    return a * b;
+#endif
+}
+
+#endif //__GEOMETRY8_H__
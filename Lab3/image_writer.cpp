@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <chrono>
+#include "image_writer.h"
+
+ImageWriter::ImageWriter(int threads, int depth, ThreadPool* pool) : frames_(), mutex_(), queued_cv_(), free_cv_(), queued_(),
+    free_(), pool_(pool), writing_(0), stop_(false), stats_(), threads_() {
+    stats_.frames = stats_.failed = 0;
+    stats_.busy_ms = stats_.stall_ms = 0.;
+    for (int i = 0; i < std::max(1, depth); i++) {
+        frames_.push_back(std::unique_ptr<Frame>(new Frame()));
+        free_.push_back(frames_.back().get());
+    }
+    for (int i = 0; i < std::max(1, threads); i++) threads_.push_back(std::thread(&ImageWriter::writer, this));
+}
+
+ImageWriter::~ImageWriter() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queued_cv_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++) threads_[i].join();
+}
+
+void ImageWriter::submit(TGAImage& image, const std::string& path) {
+    Frame* frame;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            free_cv_.wait(lock, [this] { return !free_.empty(); });
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+            stats_.stall_ms += ms.count();
+        }
+        frame = free_.back();
+        free_.pop_back();
+    }
+    // a buffer of another size is replaced once; a steady sequence just swaps
+    if (frame->image.get_width() != image.get_width() || frame->image.get_height() != image.get_height() ||
+        frame->image.get_bytespp() != image.get_bytespp())
+        frame->image = TGAImage(image.get_width(), image.get_height(), image.get_bytespp());
+    frame->image.swap(image);
+    frame->path = path;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_.push_back(frame);
+    }
+    queued_cv_.notify_one();
+}
+
+void ImageWriter::finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    free_cv_.wait(lock, [this] { return queued_.empty() && writing_ == 0; });
+}
+
+ImageWriter::Stats ImageWriter::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ImageWriter::writer() {
+    for (;;) {
+        Frame* frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_cv_.wait(lock, [this] { return stop_ || !queued_.empty(); });
+            if (queued_.empty()) return;
+            frame = queued_.front();
+            queued_.pop_front();
+            writing_++;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool ok = frame->image.write_tga_file(frame->path.c_str(), true, pool_);
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writing_--;
+            stats_.frames++;
+            if (!ok) stats_.failed++;
+            stats_.busy_ms += ms.count();
+            free_.push_back(frame);
+        }
+        free_cv_.notify_all();
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef __IMAGE_WRITER_H__
+#define __IMAGE_WRITER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "tgaimage.h"
+
+// Background output stage: finished frames are encoded and written by writer threads while the
+// renderer goes on with the next frame. Frames are handed over by swapping buffers, not copying.
+// `depth` buffers circulate; when all of them are queued or being written, submit() blocks, so a
+// renderer faster than the disk waits instead of piling up frames in memory. With a pool, each frame's
+// RLE bands are encoded on it.
+class ImageWriter {
+public:
+    struct Stats {
+        int frames;
+        int failed;
+        double busy_ms;    // summed over the writer threads
+        double stall_ms;   // submit() waiting for a free buffer, summed over the callers
+    };
+
+    explicit ImageWriter(int threads = 1, int depth = 2, ThreadPool* pool = nullptr);
+    ~ImageWriter();
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    // Takes the pixels of `image` and queues them for `path`. `image` gets a buffer of the same size
+    // and format back, with undefined content.
+    void submit(TGAImage& image, const std::string& path);
+    // Returns once everything submitted so far is written.
+    void finish();
+    Stats stats();
+
+private:
+    struct Frame {
+        TGAImage image;
+        std::string path;
+    };
+
+    void writer();
+
+    std::vector<std::unique_ptr<Frame> > frames_;
+    std::mutex mutex_;
+    std::condition_variable queued_cv_;
+    std::condition_variable free_cv_;
+    std::deque<Frame*> queued_;
+    std::vector<Frame*> free_;
+    ThreadPool* pool_;
+    int writing_;
+    bool stop_;
+    Stats stats_;
+    std::vector<std::thread> threads_;
+};
+
+#endif //__IMAGE_WRITER_H__
@@ -1,233 +1,206 @@
 ﻿#include <vector>
 #include <iostream>
-#include <cmath>
-#include <limits>
 #include <algorithm>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 
 #include "tgaimage.h"
 #include "model.h"
-#include "geometry.h"
-#include "camera.h"
+#include "compact_mesh.h"
+#include "texture_cache.h"
+#include "renderer.h"
+#include "batch.h"
+#include "server.h"
+#include "thread_pool.h"
+#include "alloc_counter.h"
+#include "bench.h"
+#include "delta_tiles.h"
+#include "poster.h"
 
-const int width = 800;
-const int height = 800;
-const int depth = 255;
-
-Model* model = nullptr;
-float* zbuffer = nullptr;
-
-Vec3f light_dir = Vec3f(1.f, -1.f, 1.f).normalize();
-
-Matrix viewport(int x, int y, int w, int h) {
-    Matrix m = Matrix::identity();
-    m[0][0] = w / 2.f;
-    m[0][3] = x + w / 2.f;
-    m[1][1] = h / 2.f;
-    m[1][3] = y + h / 2.f;
-    m[2][2] = depth / 2.f;
-    m[2][3] = depth / 2.f;
-    return m;
-}
-
-Vec3f barycentric(const Vec3f* pts, const Vec3f& P) {
-    Vec3f u = (Vec3f(pts[2].x - pts[0].x, pts[1].x - pts[0].x, pts[0].x - P.x) ^
-        Vec3f(pts[2].y - pts[0].y, pts[1].y - pts[0].y, pts[0].y - P.y));
-    if (std::fabs(u.z) < 1e-2f) return Vec3f(-1.f, 1.f, 1.f);
-    return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-}
-
-struct IShader {
-    virtual ~IShader() {}
-    virtual Vec3f vertex(int iface, int nthvert) = 0;
-    virtual bool fragment(const Vec3f& bar, TGAColor& color) = 0;
-};
-
-struct PhongShader : public IShader {
-    Model& model;
-
-    Matrix uniform_M;
-    Matrix uniform_P;
-    Matrix uniform_VP;
-
-    Vec3f  uniform_light_dir;
-    Vec3f  uniform_eye;
-
-    Vec3f  uniform_center;
-    float  uniform_scale;
-
-    Vec3f varying_world_pos[3];
-    Vec3f varying_normal[3];
-    Vec2f varying_uv[3];
-
-    PhongShader(Model& m,
-        const Matrix& modelView,
-        const Matrix& projection,
-        const Matrix& viewport,
-        const Vec3f& light_dir,
-        const Vec3f& eye,
-        const Vec3f& center,
-        float scale)
-        : model(m)
-        , uniform_M(modelView)
-        , uniform_P(projection)
-        , uniform_VP(viewport)
-        , uniform_light_dir(light_dir)
-        , uniform_eye(eye)
-        , uniform_center(center)
-        , uniform_scale(scale) {
-        uniform_light_dir.normalize();
+int main(int argc, char** argv) {
+    const char* filename = "obj/sponza.obj";
+    int width = 800;
+    int height = 800;
+    bool optimize = false;
+    bool compact = false;
+    bool rigid = true;
+    RenderOptions options;
+    int threads = 0;
+    bool pin = false;
+    bool check_allocs = false;
+    const char* bench = nullptr;
+    const char* manifest = nullptr;
+    int lanes = 0;
+    int writers = 1;
+    const char* video = nullptr;
+    int fps = 25;
+    const char* extract[3] = { nullptr, nullptr, nullptr };
+    const char* poster = nullptr;
+    int poster_tile = 1024;
+    int crop[4] = { 0, 0, 0, 0 };
+    const char* crop_file = nullptr;
+    const char* merge = nullptr;
+    std::vector<const char*> inputs;
+    const char* socket_path = nullptr;
+    int max_models = 4;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--optimize")) optimize = true;
+        else if (!strcmp(argv[i], "--compact")) compact = true;
+        else if (!strcmp(argv[i], "--textured")) options.textured = true;
+        else if (!strcmp(argv[i], "--unpacked")) options.packed = false;
+        else if (!strcmp(argv[i], "--deformable")) rigid = false;
+        else if (!strcmp(argv[i], "--scalar")) options.batched = false;
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                std::cerr << "bad size " << argv[i] << ", expected WIDTHxHEIGHT" << std::endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pin")) pin = true;
+        else if (!strcmp(argv[i], "--check-allocs")) check_allocs = true;
+        else if (!strcmp(argv[i], "--bench") && i + 1 < argc) bench = argv[++i];
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc) manifest = argv[++i];
+        else if (!strcmp(argv[i], "--lanes") && i + 1 < argc) lanes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--writers") && i + 1 < argc) writers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--video") && i + 1 < argc) video = argv[++i];
+        else if (!strcmp(argv[i], "--fps") && i + 1 < argc) fps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--poster") && i + 1 < argc) poster = argv[++i];
+        else if (!strcmp(argv[i], "--tile") && i + 1 < argc) poster_tile = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--crop") && i + 2 < argc) {
+            if (sscanf(argv[++i], "%d,%d,%dx%d", &crop[0], &crop[1], &crop[2], &crop[3]) != 4 || crop[0] < 0 || crop[1] < 0 ||
+                crop[2] <= 0 || crop[3] <= 0) {
+                std::cerr << "bad crop " << argv[i] << ", expected X,Y,WIDTHxHEIGHT" << std::endl;
+                return 1;
+            }
+            crop_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--merge") && i + 1 < argc) merge = argv[++i];
+        else if (!strcmp(argv[i], "--extract") && i + 3 < argc) {
+            for (int k = 0; k < 3; k++) extract[k] = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--serve") && i + 1 < argc) socket_path = argv[++i];
+        else if (!strcmp(argv[i], "--models") && i + 1 < argc) max_models = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--specular") && i + 1 < argc) {
+            if (!SpecularPower::parse(argv[++i], options.specular)) std::cerr << "unknown specular mode " << argv[i] << std::endl;
+        }
+        else if (!strcmp(argv[i], "--texture-budget") && i + 1 < argc)
+            TextureCache::instance().set_budget((size_t)(atof(argv[++i]) * 1024 * 1024));
+        else inputs.push_back(argv[i]);
     }
-
-    Vec3f vertex(int iface, int nthvert) override {
-        const std::vector<int> face = model.face(iface);
-        int v_idx = face[nthvert];
-
-        Vec3f v_raw = model.vert(v_idx);
-        Vec3f v = (v_raw - uniform_center) * uniform_scale;
-        varying_world_pos[nthvert] = v;
-
-        Vec3f n = model.norm(iface, nthvert).normalize();
-        varying_normal[nthvert] = n;
-
-        Vec2i uv_i = model.uv(iface, nthvert);
-        varying_uv[nthvert] = Vec2f((float)uv_i.x, (float)uv_i.y);
-
-        Vec4f v4(v.x, v.y, v.z, 1.f);
-        Vec4f view = uniform_M * v4;
-        Vec4f clip = uniform_P * view;
-
-        float w = (std::fabs(clip.w) > 1e-6f) ? clip.w : 1.f;
-        clip.x /= w;
-        clip.y /= w;
-        clip.z /= w;
-
-        Vec4f screen = uniform_VP * clip;
-
-        return Vec3f(screen.x, screen.y, screen.z);
+    if (!inputs.empty()) filename = inputs.back();
+    // --extract <sequence.tiles> <frame> <out.tga>
+    if (extract[0]) {
+        TileDeltaReader reader;
+        TGAImage frame;
+        if (!reader.open(extract[0])) return 1;
+        if (!reader.read(atoi(extract[1]), frame)) {
+            std::cerr << "can't read frame " << extract[1] << " of " << reader.frames() << std::endl;
+            return 1;
+        }
+        return frame.write_tga_file(extract[2]) ? 0 : 1;
     }
-
-    bool fragment(const Vec3f& bar, TGAColor& color) override {
-        Vec3f p = varying_world_pos[0] * bar.x +
-            varying_world_pos[1] * bar.y +
-            varying_world_pos[2] * bar.z;
-
-        Vec3f n = (varying_normal[0] * bar.x +
-            varying_normal[1] * bar.y +
-            varying_normal[2] * bar.z).normalize();
-
-        TGAColor base(200, 200, 200);
-
-        Vec3f L = uniform_light_dir;
-        Vec3f V = (uniform_eye - p).normalize();
-        Vec3f R = (n * (2.f * (n * L)) - L).normalize();
-
-        float ambient = 0.2f;
-        float diff = std::max(0.f, n * L);
-        float spec = std::pow(std::max(0.f, R * V), 32.f);
-
-        float intensity = ambient + diff + 0.4f * spec;
-        color = base * intensity;
-        return false;
+    // --merge <out.tga> <crop.tga>..., at --size
+    if (merge) return merge_crops(merge, width, height, inputs) ? 0 : 1;
+    if (crop_file && (crop[0] + crop[2] > width || crop[1] + crop[3] > height)) {
+        std::cerr << "the crop doesn't fit the " << width << "x" << height << " frame" << std::endl;
+        return 1;
     }
-};
-
-void triangle(Vec3f* pts, IShader& shader, TGAImage& image, float* zbuffer) {
-    Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(width - 1.f, height - 1.f);
-
-    for (int i = 0; i < 3; i++) {
-        bboxmin.x = std::max(0.f, std::min(bboxmin.x, pts[i].x));
-        bboxmin.y = std::max(0.f, std::min(bboxmin.y, pts[i].y));
-        bboxmax.x = std::min(clamp.x, std::max(bboxmax.x, pts[i].x));
-        bboxmax.y = std::min(clamp.y, std::max(bboxmax.y, pts[i].y));
+    if (check_allocs && heap_allocations() < 0) {
+        std::cerr << "# heap allocation check unavailable: build with LAB3_COUNT_ALLOCS defined" << std::endl;
+        return 1;
     }
-
-    for (int x = (int)bboxmin.x; x <= (int)bboxmax.x; x++) {
-        for (int y = (int)bboxmin.y; y <= (int)bboxmax.y; y++) {
-            Vec3f P((float)x + 0.5f, (float)y + 0.5f, 0.f);
-            Vec3f bc = barycentric(pts, P);
-            if (bc.x < 0.f || bc.y < 0.f || bc.z < 0.f) continue;
-
-            float z = pts[0].z * bc.x +
-                pts[1].z * bc.y +
-                pts[2].z * bc.z;
-
-            int idx = x + y * width;
-            if (idx < 0 || idx >= width * height) continue;
-
-            if (zbuffer[idx] < z) {
-                TGAColor color;
-                if (!shader.fragment(bc, color)) {
-                    zbuffer[idx] = z;
-                    image.set(x, y, color);
-                }
-            }
-        }
+    if (video && !manifest) {
+        std::cerr << "--video streams the frames of a --batch manifest" << std::endl;
+        return 1;
     }
-}
-
-int main(int argc, char** argv) {
-    if (argc == 2) model = new Model(argv[1]);
-    else          model = new Model("obj/sponza.obj");
-
-    zbuffer = new float[width * height];
-    for (int i = 0; i < width * height; i++)
-        zbuffer[i] = -std::numeric_limits<float>::infinity();
-
-    Vec3f bbmin(std::numeric_limits<float>::max(),
-        std::numeric_limits<float>::max(),
-        std::numeric_limits<float>::max());
-    Vec3f bbmax(-std::numeric_limits<float>::max(),
-        -std::numeric_limits<float>::max(),
-        -std::numeric_limits<float>::max());
-    for (int i = 0; i < model->nverts(); i++) {
-        Vec3f v = model->vert(i);
-        bbmin.x = std::min(bbmin.x, v.x);
-        bbmin.y = std::min(bbmin.y, v.y);
-        bbmin.z = std::min(bbmin.z, v.z);
-        bbmax.x = std::max(bbmax.x, v.x);
-        bbmax.y = std::max(bbmax.y, v.y);
-        bbmax.z = std::max(bbmax.z, v.z);
+    ThreadPool pool(threads, pin);
+    if (socket_path) return run_server(socket_path, pool, options, rigid, max_models, lanes > 0 ? lanes : pool.size());
+    Model* model = new Model(filename, &pool);
+    model->set_rigid(rigid);
+    if (optimize) model->optimize();
+    if (bench) {
+        bool ok = run_benchmark(bench, *model);
+        delete model;
+        if (!ok) std::cerr << "unknown benchmark " << bench << std::endl;
+        return ok ? 0 : 1;
     }
-    Vec3f center = Vec3f((bbmin.x + bbmax.x) * 0.5f,
-        (bbmin.y + bbmax.y) * 0.5f,
-        (bbmin.z + bbmax.z) * 0.5f);
-    Vec3f extent = Vec3f(bbmax.x - bbmin.x,
-        bbmax.y - bbmin.y,
-        bbmax.z - bbmin.z);
-    float radius = std::max(extent.x, std::max(extent.y, extent.z)) * 0.5f;
-    float scale = (radius > 1e-6f) ? (1.0f / radius) : 1.0f;
-
-    Camera camera(
-        Vec3f(0.f, 0.f, 5.f),
-        Vec3f(0.f, 0.f, 0.f),
-        Vec3f(0.f, 1.f, 0.f),
-        60.f,
-        (float)width / (float)height,
-        0.1f,
-        100.f
-    );
 
+    CompactMesh* mesh = nullptr;
+    if (compact) {
+        mesh = new CompactMesh(*model);
+        // the float geometry is not drawn from anymore; the peak below still includes it
+        float model_bytes = model->bytes() / (float)std::max(1, model->nfaces());
+        model->release_geometry(options.textured);
+        std::cerr << "# compact " << mesh->bytes() / (float)std::max(1, mesh->nfaces()) << " bytes/tri, model "
+            << model_bytes << " bytes/tri released";
+#if !defined(_WIN32)
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) std::cerr << ", peak resident " << usage.ru_maxrss / 1024. << " MB";
+#endif
+        std::cerr << std::endl;
+    }
 
-    Matrix ModelView = camera.viewMatrix();
-    Matrix Projection = camera.projectionMatrix();
-    Matrix ViewPort = viewport(0, 0, width, height);
+    if (manifest) {
+        std::vector<RenderJob> jobs;
+        int failed = load_jobs(manifest, jobs) ? run_batch(*model, pool, mesh, options, jobs, lanes > 0 ? lanes : pool.size(), writers,
+            video, fps) : -1;
+        if (failed > 0) std::cerr << failed << " jobs could not be written" << std::endl;
+        delete mesh;
+        delete model;
+        return failed ? 1 : 0;
+    }
 
-    TGAImage image(width, height, TGAImage::RGB);
-    PhongShader shader(*model, ModelView, Projection, ViewPort, light_dir, camera.position(), center, scale);
+    // --poster out.tga, at --size, in --tile sized windows
+    if (poster) {
+        bool ok = render_poster(*model, pool, mesh, options, poster, width, height, poster_tile);
+        delete mesh;
+        delete model;
+        return ok ? 0 : 1;
+    }
 
-    for (int i = 0; i < model->nfaces(); i++) {
-        Vec3f screen_coords[3];
-        for (int j = 0; j < 3; j++)
-            screen_coords[j] = shader.vertex(i, j);
-        triangle(screen_coords, shader, image, zbuffer);
+    Renderer renderer(*model, pool, mesh, options);
+    renderer.resize(width, height);
+    renderer.set_camera(Renderer::default_camera(width, height));
+    // --crop X,Y,WxH <out.tga>: that window of the --size frame, positioned by the file's origin
+    if (crop_file) renderer.set_window(crop[0], crop[1], crop[2], crop[3]);
+
+    // with --check-allocs the first frames warm up the arenas and the pool, the last one must not allocate
+    int frames = check_allocs ? 3 : 1;
+    long allocations = 0;
+    for (int f = 0; f < frames; f++) {
+        long allocated = heap_allocations();
+        renderer.render();
+        allocations = heap_allocations() - allocated;
+        std::cerr << "# vertex stage " << renderer.vertex_ms() << " ms on " << pool.size() << " threads" << std::endl;
+        std::cerr << "# frame " << renderer.frame_ms() << " ms, " << renderer.nfaces() / (renderer.frame_ms() * 1e3) << " Mtri/s" << std::endl;
     }
+    if (check_allocs) {
+        std::cerr << "# heap allocations in steady-state frame: " << allocations << std::endl;
+        if (allocations) {
+            std::cerr << "frame allocated on the heap" << std::endl;
+            return 1;
+        }
+    }
+
+    TGAImage& image = renderer.image();
+    const char* output = crop_file ? crop_file : "output.tga";
+    int x_origin = renderer.window_x(), y_origin = renderer.window_y();
+    bool written = false;
+    TaskHandle write = pool.submit([&image, &pool, &written, output, x_origin, y_origin] {
+        written = image.write_tga_file(output, true, &pool, x_origin, y_origin);
+    });
+    pool.wait(write);
 
-    image.flip_vertically();
-    image.write_tga_file("output.tga");
+    TextureCache::Stats tex = TextureCache::instance().stats();
+    std::cerr << "# textures: " << tex.hits << " hits, " << tex.misses << " misses, " << tex.evictions << " evictions, "
+        << tex.bytes_resident / 1024 << " KB resident, " << tex.load_ms << " ms loading" << std::endl;
 
+    delete mesh;
     delete model;
-    delete[] zbuffer;
-    return 0;
+    return written ? 0 : 1;
 }
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include "material_texture.h"
+
+namespace {
+
+// Texels are in uv order, v up; image rows go down.
+TGAColor sample(TGAImage* img, int x, int y, int w, int h) {
+    return img->get(x * img->get_width() / w, img->get_height() - 1 - y * img->get_height() / h);
+}
+
+unsigned int unorm12(float v) {
+    v = std::min(1.f, std::max(-1.f, v));
+    return (unsigned int)((v * .5f + .5f) * 4095.f + .5f);
+}
+
+float sign_not_zero(float v) {
+    return v >= 0.f ? 1.f : -1.f;
+}
+
+}
+
+MaterialTexture::MaterialTexture(TGAImage* diffuse, TGAImage* normal, TGAImage* specular, bool tangent_space)
+    : texels_(), width_(1), height_(1), blocks_x_(1), has_normal_(normal != nullptr), tangent_space_(tangent_space) {
+    TGAImage* maps[3] = { diffuse, normal, specular };
+    for (int i = 2; i >= 0; i--) {
+        if (maps[i] && maps[i]->get_width() > 0) {
+            width_ = maps[i]->get_width();
+            height_ = maps[i]->get_height();
+        }
+    }
+    blocks_x_ = (width_ + 3) / 4;
+    texels_.resize(blocks_x_ * 4 * ((height_ + 3) / 4) * 4);
+
+    for (int y = 0; y < height_; y++) {
+        for (int x = 0; x < width_; x++) {
+            MaterialTexel& t = texels_[((y >> 2) * blocks_x_ + (x >> 2)) * 16 + (y & 3) * 4 + (x & 3)];
+            TGAColor c = diffuse ? sample(diffuse, x, y, width_, height_) : TGAColor(255, 255, 255);
+            if (c.bytespp == 1) c = TGAColor(c.bgra[0], c.bgra[0], c.bgra[0]);
+            for (int k = 0; k < 4; k++) t.diffuse[k] = c.bgra[k];
+            if (c.bytespp == 3) t.diffuse[3] = 255;
+
+            Vec3f n(0.f, 0.f, 1.f);
+            if (normal) {
+                TGAColor nc = sample(normal, x, y, width_, height_);
+                n = Vec3f(nc.bgra[2] / 255.f * 2.f - 1.f, nc.bgra[1] / 255.f * 2.f - 1.f, nc.bgra[0] / 255.f * 2.f - 1.f);
+            }
+            unsigned char spec = specular ? sample(specular, x, y, width_, height_).bgra[0] : 0;
+            t.normal_spec = encode(n, spec);
+        }
+    }
+}
+
+unsigned int MaterialTexture::encode(const Vec3f& n, unsigned char spec) {
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    float ox = l1 > 0.f ? n.x / l1 : 0.f;
+    float oy = l1 > 0.f ? n.y / l1 : 0.f;
+    if (n.z < 0.f) {
+        float tx = (1.f - std::fabs(oy)) * sign_not_zero(ox);
+        oy = (1.f - std::fabs(ox)) * sign_not_zero(oy);
+        ox = tx;
+    }
+    return unorm12(ox) | (unorm12(oy) << 12) | ((unsigned int)spec << 24);
+}
+
+Vec3f MaterialTexture::normal(const MaterialTexel& t) {
+    Vec3f n((t.normal_spec & 4095) / 4095.f * 2.f - 1.f, ((t.normal_spec >> 12) & 4095) / 4095.f * 2.f - 1.f, 0.f);
+    n.z = 1.f - std::fabs(n.x) - std::fabs(n.y);
+    float s = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -s : s;
+    n.y += n.y >= 0.f ? -s : s;
+    return n.normalize();
+}
@@ -0,0 +1,51 @@
+#ifndef __MATERIAL_TEXTURE_H__
+#define __MATERIAL_TEXTURE_H__
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include "geometry.h"
+#include "tgaimage.h"
+
+// Everything a fragment needs from the material maps in one 8-byte fetch.
+struct MaterialTexel {
+    unsigned char diffuse[4];  // bgra, as in TGAColor
+    unsigned int normal_spec;  // bits 0-11 and 12-23: octahedron-encoded normal, bits 24-31: specular
+};
+
+// Diffuse, normal and specular maps interleaved into MaterialTexels. Texels are stored in 4x4 blocks
+// (128 bytes, two cache lines) so that neighbouring fragments of any orientation hit the same lines.
+class MaterialTexture {
+private:
+    std::vector<MaterialTexel> texels_;
+    int width_;
+    int height_;
+    int blocks_x_;
+    bool has_normal_;
+    bool tangent_space_;
+public:
+    // Any map may be null; the other maps are resampled to the size of the first present one.
+    MaterialTexture(TGAImage* diffuse, TGAImage* normal, TGAImage* specular, bool tangent_space = false);
+    int get_width() const { return width_; }
+    int get_height() const { return height_; }
+    size_t bytes() const { return texels_.size() * sizeof(MaterialTexel); }
+    bool has_normal() const { return has_normal_; }
+    bool tangent_space() const { return tangent_space_; }
+
+    // Nearest texel, uv wraps around.
+    const MaterialTexel& fetch(const Vec2f& uv) const {
+        float u = uv.x - std::floor(uv.x);
+        float v = uv.y - std::floor(uv.y);
+        int x = (int)(u * width_);
+        int y = (int)(v * height_);
+        if (x >= width_) x = width_ - 1;
+        if (y >= height_) y = height_ - 1;
+        return texels_[((y >> 2) * blocks_x_ + (x >> 2)) * 16 + (y & 3) * 4 + (x & 3)];
+    }
+
+    static unsigned int encode(const Vec3f& n, unsigned char spec);
+    static Vec3f normal(const MaterialTexel& t);
+    static float specular(const MaterialTexel& t) { return (t.normal_spec >> 24) / 255.f; }
+};
+
+#endif //__MATERIAL_TEXTURE_H__
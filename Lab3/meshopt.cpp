@@ -0,0 +1,119 @@
+#include <vector>
+#include "meshopt.h"
+
+float acmr(const std::vector<int>& indices, int nverts, int cache_size) {
+    int ntris = (int)indices.size() / 3;
+    if (!ntris) return 0.f;
+    // timestamp[v] is the value of `misses` when v entered the cache; FIFO eviction means
+    // v is still resident while fewer than cache_size misses happened since.
+    std::vector<int> timestamp(nverts, -cache_size - 1);
+    int misses = 0;
+    for (int i = 0; i < ntris * 3; i++) {
+        int v = indices[i];
+        if (misses - timestamp[v] > cache_size) {
+            timestamp[v] = misses;
+            misses++;
+        }
+    }
+    return misses / (float)ntris;
+}
+
+namespace {
+
+struct Tipsify {
+    const std::vector<int>& indices;
+    int cache_size;
+    std::vector<int> adj_offset;    // vertex -> range in adj
+    std::vector<int> adj;           // triangles using each vertex
+    std::vector<int> live;          // not yet emitted triangles per vertex
+    std::vector<int> cache_time;
+    std::vector<bool> emitted;
+    std::vector<int> dead_end;
+    int time;
+    int cursor;
+
+    Tipsify(const std::vector<int>& idx, int nverts, int k)
+        : indices(idx), cache_size(k), adj_offset(nverts + 1, 0), adj(idx.size()), live(nverts, 0),
+        cache_time(nverts, 0), emitted(idx.size() / 3, false), dead_end(), time(k + 1), cursor(0) {
+        for (int i = 0; i < (int)indices.size(); i++) live[indices[i]]++;
+        for (int v = 0; v < nverts; v++) adj_offset[v + 1] = adj_offset[v] + live[v];
+        std::vector<int> fill(adj_offset.begin(), adj_offset.end() - 1);
+        for (int i = 0; i < (int)indices.size(); i++) adj[fill[indices[i]]++] = i / 3;
+    }
+
+    int skip_dead_end() {
+        while (!dead_end.empty()) {
+            int d = dead_end.back();
+            dead_end.pop_back();
+            if (live[d] > 0) return d;
+        }
+        while (cursor < (int)live.size()) {
+            if (live[cursor] > 0) return cursor;
+            cursor++;
+        }
+        return -1;
+    }
+
+    int next_vertex(const std::vector<int>& candidates) {
+        int best = -1;
+        int best_priority = -1;
+        for (int i = 0; i < (int)candidates.size(); i++) {
+            int v = candidates[i];
+            if (live[v] <= 0) continue;
+            // prefer the oldest vertex that still stays in cache after its fan is emitted
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size) priority = time - cache_time[v];
+            if (priority > best_priority) {
+                best_priority = priority;
+                best = v;
+            }
+        }
+        return best < 0 ? skip_dead_end() : best;
+    }
+
+    std::vector<int> run() {
+        std::vector<int> order;
+        order.reserve(emitted.size());
+        std::vector<int> candidates;
+        int fan = indices.empty() ? -1 : 0;
+        while (fan >= 0) {
+            candidates.clear();
+            for (int a = adj_offset[fan]; a < adj_offset[fan + 1]; a++) {
+                int t = adj[a];
+                if (emitted[t]) continue;
+                for (int j = 0; j < 3; j++) {
+                    int v = indices[t * 3 + j];
+                    dead_end.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - cache_time[v] > cache_size) cache_time[v] = time++;
+                }
+                emitted[t] = true;
+                order.push_back(t);
+            }
+            fan = next_vertex(candidates);
+        }
+        return order;
+    }
+};
+
+}
+
+std::vector<int> optimize_vertex_cache(const std::vector<int>& indices, int nverts, int cache_size) {
+    Tipsify t(indices, nverts, cache_size);
+    return t.run();
+}
+
+int optimize_vertex_fetch(std::vector<int>& indices, int nverts, std::vector<int>& remap) {
+    remap.assign(nverts, -1);
+    int next = 0;
+    for (int i = 0; i < (int)indices.size(); i++) {
+        int& v = indices[i];
+        if (remap[v] < 0) remap[v] = next++;
+        v = remap[v];
+    }
+    int referenced = next;
+    for (int v = 0; v < nverts; v++)
+        if (remap[v] < 0) remap[v] = next++;
+    return referenced;
+}
@@ -0,0 +1,18 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+
+#include <vector>
+
+// Triangle-list optimizations. `indices` is a flat list of vertex ids, three per triangle.
+
+// Average cache miss ratio (misses per triangle) of a FIFO post-transform cache.
+float acmr(const std::vector<int>& indices, int nverts, int cache_size = 16);
+
+// Tipsify (Sander et al. 2007): returns the new triangle order, order[k] is the old triangle id.
+std::vector<int> optimize_vertex_cache(const std::vector<int>& indices, int nverts, int cache_size = 16);
+
+// Renumbers vertices in first-use order, unreferenced vertices go last. remap[old] = new;
+// indices are rewritten in place, the return value is the number of referenced vertices.
+int optimize_vertex_fetch(std::vector<int>& indices, int nverts, std::vector<int>& remap);
+
+#endif //__MESHOPT_H__
@@ -3,34 +3,79 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
 #include "model.h"
+#include "meshopt.h"
+#include "texture_cache.h"
+#include "normal_baker.h"
+#include "thread_pool.h"
 
-Model::Model(const char* filename) : verts_(), faces_(), norms_(), uv_(), diffusemap_() {
-    std::ifstream in;
-    in.open(filename, std::ifstream::in);
-    if (in.fail()) return;
+static std::string directory_of(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+// Rest of the line after the keyword, without surrounding whitespace.
+static std::string argument(const std::string& line, size_t keyword) {
+    size_t b = line.find_first_not_of(" \t", keyword);
+    size_t e = line.find_last_not_of(" \t\r");
+    return (b == std::string::npos || e < b) ? std::string() : line.substr(b, e - b + 1);
+}
+
+// Only TGA is supported, so "foo.png" falls back to "foo.tga" next to it.
+static std::string texture_path(const std::string& dir, std::string name) {
+    size_t opt = name.find_last_of(" \t");
+    if (opt != std::string::npos) name = name.substr(opt + 1);  // map_Kd -bm 1 file.tga
+    for (size_t i = 0; i < name.size(); i++)
+        if (name[i] == '\\') name[i] = '/';
+    size_t dot = name.find_last_of(".");
+    if (dot != std::string::npos) name = name.substr(0, dot);
+    return dir + name + ".tga";
+}
+
+namespace {
+
+// Chunks below this size are not worth a task.
+const size_t parse_chunk = 1 << 20;
+
+// What one chunk of OBJ text contributes. mtllib/usemtl lines depend on what came before, so they are
+// kept as directives tagged with the number of faces parsed before them and applied during the merge.
+struct ObjChunk {
+    std::vector<Vec3f> verts;
+    std::vector<Vec3f> norms;
+    std::vector<Vec2f> uv;
+    std::vector<std::vector<Vec3i> > faces;
+    std::vector<std::pair<int, std::string> > directives;
+};
+
+void parse_obj(const char* begin, const char* end, ObjChunk& out) {
     std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
+    while (begin < end) {
+        const char* eol = std::find(begin, end, '\n');
+        line.assign(begin, eol);
+        begin = eol + 1;
         std::istringstream iss(line.c_str());
         char trash;
         if (!line.compare(0, 2, "v ")) {
             iss >> trash;
             Vec3f v;
             for (int i = 0; i < 3; i++) iss >> v[i];
-            verts_.push_back(v);
+            out.verts.push_back(v);
         }
         else if (!line.compare(0, 3, "vn ")) {
             iss >> trash >> trash;
             Vec3f n;
             for (int i = 0; i < 3; i++) iss >> n[i];
-            norms_.push_back(n);
+            out.norms.push_back(n);
         }
         else if (!line.compare(0, 3, "vt ")) {
             iss >> trash >> trash;
             Vec2f uv;
             for (int i = 0; i < 2; i++) iss >> uv[i];
-            uv_.push_back(uv);
+            out.uv.push_back(uv);
         }
         else if (!line.compare(0, 2, "f ")) {
             std::vector<Vec3i> f;
@@ -40,11 +85,136 @@ Model::Model(const char* filename) : verts_(), faces_(), norms_(), uv_(), diffus
                 for (int i = 0; i < 3; i++) tmp[i]--;
                 f.push_back(tmp);
             }
-            faces_.push_back(f);
+            out.faces.push_back(f);
+        }
+        else if (!line.compare(0, 7, "mtllib ") || !line.compare(0, 7, "usemtl ")) {
+            out.directives.push_back(std::make_pair((int)out.faces.size(), line));
+        }
+    }
+}
+
+template <class T>
+void append(std::vector<T>& dst, std::vector<T>& src) {
+    dst.insert(dst.end(), std::make_move_iterator(src.begin()), std::make_move_iterator(src.end()));
+    std::vector<T>().swap(src);
+}
+
+}
+
+Model::Model(const char* filename, ThreadPool* pool) : verts_(), faces_(), norms_(), uv_(), tangents_(), materials_(1), ranges_(), packed_(), baked_(), packed_mutex_(), rigid_(true) {
+    materials_[0].name = "default";
+    std::vector<int> face_material;
+    int current = 0;
+    bool has_mtl = false;
+    std::ifstream in;
+    in.open(filename, std::ifstream::in | std::ifstream::binary);
+    if (in.fail()) return;
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // chunk boundaries right after a newline
+    std::vector<size_t> bounds(1, 0);
+    int nchunks = pool ? (int)std::min<size_t>(text.size() / parse_chunk + 1, pool->size() * 4) : 1;
+    for (int c = 1; c < nchunks; c++) {
+        size_t eol = text.find('\n', std::max(bounds.back(), text.size() * c / nchunks));
+        if (eol == std::string::npos) break;
+        bounds.push_back(eol + 1);
+    }
+    bounds.push_back(text.size());
+    std::vector<ObjChunk> chunks(bounds.size() - 1);
+    if (pool) {
+        pool->parallel_for(0, (int)chunks.size(), 1, [&](int first, int last) {
+            for (int c = first; c < last; c++) parse_obj(text.data() + bounds[c], text.data() + bounds[c + 1], chunks[c]);
+        });
+    }
+    else {
+        parse_obj(text.data(), text.data() + text.size(), chunks[0]);
+    }
+
+    for (size_t c = 0; c < chunks.size(); c++) {
+        ObjChunk& chunk = chunks[c];
+        size_t d = 0;
+        for (int f = 0; f <= (int)chunk.faces.size(); f++) {
+            for (; d < chunk.directives.size() && chunk.directives[d].first == f; d++) {
+                const std::string& line = chunk.directives[d].second;
+                if (!line.compare(0, 7, "mtllib ")) {
+                    load_mtl(directory_of(filename) + argument(line, 7));
+                    has_mtl = true;
+                    continue;
+                }
+                std::string name = argument(line, 7);
+                for (current = 0; current < (int)materials_.size() && materials_[current].name != name; current++) {}
+                if (current == (int)materials_.size()) {
+                    materials_.push_back(Material());
+                    materials_.back().name = name;
+                }
+            }
+            if (f < (int)chunk.faces.size()) face_material.push_back(current);
+        }
+        append(verts_, chunk.verts);
+        append(norms_, chunk.norms);
+        append(uv_, chunk.uv);
+        append(faces_, chunk.faces);
+    }
+    // normalized once here, so that the accessors never write and can be called from any thread
+    for (size_t i = 0; i < norms_.size(); i++) norms_[i].normalize();
+    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << " mtl# " << materials_.size() - 1 << std::endl;
+
+    // counting sort of the faces by material, the order inside a material is kept
+    std::vector<int> start(materials_.size() + 1, 0);
+    for (int i = 0; i < (int)faces_.size(); i++) start[face_material[i] + 1]++;
+    for (int m = 0; m < (int)materials_.size(); m++) {
+        start[m + 1] += start[m];
+        MaterialRange r = { m, start[m], start[m + 1] - start[m] };
+        if (r.count) ranges_.push_back(r);
+    }
+    std::vector<std::vector<Vec3i> > grouped(faces_.size());
+    for (int i = 0; i < (int)faces_.size(); i++) grouped[start[face_material[i]]++].swap(faces_[i]);
+    faces_.swap(grouped);
+
+    if (!has_mtl) {
+        default_texture(filename, "_diffuse.tga", materials_[0].diffuse_path);
+        default_texture(filename, "_nm.tga", materials_[0].normal_path);
+        default_texture(filename, "_spec.tga", materials_[0].specular_path);
+    }
+    packed_.resize(materials_.size());
+    baked_.resize(materials_.size());
+    compute_tangents();
+}
+
+void Model::load_mtl(const std::string& filename) {
+    std::ifstream in;
+    in.open(filename.c_str(), std::ifstream::in);
+    if (in.fail()) {
+        std::cerr << "can't open material library " << filename << std::endl;
+        return;
+    }
+    std::string dir = directory_of(filename);
+    Material* mat = nullptr;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t b = line.find_first_not_of(" \t");
+        if (b == std::string::npos) continue;
+        line = line.substr(b);
+        if (!line.compare(0, 7, "newmtl ")) {
+            materials_.push_back(Material());
+            mat = &materials_.back();
+            mat->name = argument(line, 7);
+        }
+        else if (mat && !line.compare(0, 7, "map_Kd ")) {
+            mat->diffuse_path = texture_path(dir, argument(line, 7));
+        }
+        else if (mat && !line.compare(0, 7, "map_Ks ")) {
+            mat->specular_path = texture_path(dir, argument(line, 7));
+        }
+        else if (mat && (!line.compare(0, 9, "map_Bump ") || !line.compare(0, 9, "map_bump "))) {
+            mat->normal_path = texture_path(dir, argument(line, 9));
+            mat->tangent_normals = true;
+        }
+        else if (mat && (!line.compare(0, 5, "bump ") || !line.compare(0, 5, "norm "))) {
+            mat->normal_path = texture_path(dir, argument(line, 5));
+            mat->tangent_normals = true;
         }
     }
-    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap_);
 }
 
 Model::~Model() {
@@ -58,37 +228,242 @@ int Model::nfaces() {
     return (int)faces_.size();
 }
 
-std::vector<int> Model::face(int idx) {
-    std::vector<int> face;
-    for (int i = 0; i < (int)faces_[idx].size(); i++) face.push_back(faces_[idx][i][0]);
-    return face;
+int Model::face_size(int iface) {
+    return (int)faces_[iface].size();
 }
 
 Vec3f Model::vert(int i) {
     return verts_[i];
 }
 
-void Model::load_texture(std::string filename, const char* suffix, TGAImage& img) {
+void Model::default_texture(std::string filename, const char* suffix, std::string& path) {
     std::string texfile(filename);
     size_t dot = texfile.find_last_of(".");
-    if (dot != std::string::npos) {
-        texfile = texfile.substr(0, dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
+    if (dot != std::string::npos) path = texfile.substr(0, dot) + std::string(suffix);
+}
+
+static std::shared_ptr<TGAImage> cached_texture(const std::string& path) {
+    return path.empty() ? std::shared_ptr<TGAImage>() : TextureCache::instance().get(path);
+}
+
+std::shared_ptr<TGAImage> Model::diffuse_map(int material) {
+    return cached_texture(materials_[material].diffuse_path);
+}
+
+std::shared_ptr<TGAImage> Model::normal_map(int material) {
+    return cached_texture(materials_[material].normal_path);
+}
+
+std::shared_ptr<TGAImage> Model::specular_map(int material) {
+    return cached_texture(materials_[material].specular_path);
+}
+
+std::shared_ptr<TGAImage> Model::object_normal_map(int material) {
+    std::lock_guard<std::mutex> lock(packed_mutex_);
+    return object_normal_map_locked(material);
+}
+
+std::shared_ptr<TGAImage> Model::object_normal_map_locked(int material) {
+    if (!materials_[material].tangent_normals || !rigid_) return normal_map(material);
+    if (!baked_[material]) {
+        std::shared_ptr<TGAImage> tangent_map = normal_map(material);
+        if (!tangent_map) return tangent_map;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        baked_[material] = std::make_shared<TGAImage>();
+        bake_object_space_normals(*this, material, *tangent_map, *baked_[material]);
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        std::cerr << "# baked object-space normals " << materials_[material].name << " in " << ms.count() << " ms" << std::endl;
+    }
+    return baked_[material];
+}
+
+// Packed maps are built on the first request and kept by the model; the source images stay in the cache.
+std::shared_ptr<MaterialTexture> Model::material_texture(int material) {
+    std::lock_guard<std::mutex> lock(packed_mutex_);
+    if (!packed_[material]) {
+        std::shared_ptr<TGAImage> diffuse = diffuse_map(material);
+        std::shared_ptr<TGAImage> normal = object_normal_map_locked(material);
+        std::shared_ptr<TGAImage> specular = specular_map(material);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        packed_[material] = std::make_shared<MaterialTexture>(diffuse.get(), normal.get(), specular.get(),
+            materials_[material].tangent_normals && !rigid_);
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        std::cerr << "# packed material " << materials_[material].name << " " << packed_[material]->get_width() << "x"
+            << packed_[material]->get_height() << ", " << packed_[material]->bytes() / 1024 << " KB in " << ms.count() << " ms" << std::endl;
     }
+    return packed_[material];
 }
 
-TGAColor Model::diffuse(Vec2i uv) {
-    return diffusemap_.get(uv.x, uv.y);
+int Model::nmaterials() {
+    return (int)materials_.size();
 }
 
-Vec2i Model::uv(int iface, int nvert) {
-    int idx = faces_[iface][nvert][1];
-    return Vec2i(uv_[idx].x * diffusemap_.get_width(), uv_[idx].y * diffusemap_.get_height());
+Material& Model::material(int i) {
+    return materials_[i];
+}
+
+int Model::face_material(int iface) {
+    int lo = 0, hi = (int)ranges_.size() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (ranges_[mid].first <= iface) lo = mid;
+        else hi = mid - 1;
+    }
+    return ranges_.empty() ? 0 : ranges_[lo].material;
+}
+
+int Model::nranges() {
+    return (int)ranges_.size();
+}
+
+MaterialRange Model::range(int i) {
+    return ranges_[i];
 }
 
 Vec3f Model::norm(int iface, int nvert) {
     int idx = faces_[iface][nvert][2];
-    return norms_[idx].normalize();
+    return norms_[idx];
+}
+
+void Model::set_rigid(bool rigid) {
+    std::lock_guard<std::mutex> lock(packed_mutex_);
+    if (rigid_ == rigid) return;
+    rigid_ = rigid;
+    for (int m = 0; m < (int)materials_.size(); m++) {
+        if (!materials_[m].tangent_normals) continue;
+        packed_[m].reset();
+        baked_[m].reset();
+    }
+}
+
+bool Model::rigid() {
+    return rigid_;
+}
+
+// Per-vertex tangent frames (Lengyel), accumulated over the faces sharing a normal index.
+void Model::compute_tangents() {
+    tangents_.clear();
+    bool needed = false;
+    for (int m = 0; m < (int)materials_.size(); m++) needed = needed || materials_[m].tangent_normals;
+    if (!needed) return;
+
+    std::vector<Vec3f> tan(norms_.size()), bitan(norms_.size());
+    for (int i = 0; i < (int)faces_.size(); i++) {
+        for (int k = 1; k + 1 < (int)faces_[i].size(); k++) {
+            const Vec3i& c0 = faces_[i][0];
+            const Vec3i& c1 = faces_[i][k];
+            const Vec3i& c2 = faces_[i][k + 1];
+            Vec3f e1 = verts_[c1.x] - verts_[c0.x];
+            Vec3f e2 = verts_[c2.x] - verts_[c0.x];
+            Vec2f d1 = texcoord(c1.y) - texcoord(c0.y);
+            Vec2f d2 = texcoord(c2.y) - texcoord(c0.y);
+            float det = d1.x * d2.y - d2.x * d1.y;
+            if (std::fabs(det) < 1e-12f) continue;
+            Vec3f t = (e1 * d2.y - e2 * d1.y) * (1.f / det);
+            Vec3f b = (e2 * d1.x - e1 * d2.x) * (1.f / det);
+            const Vec3i* c[3] = { &c0, &c1, &c2 };
+            for (int j = 0; j < 3; j++) {
+                int n = c[j]->z;
+                if (n < 0 || n >= (int)norms_.size()) continue;
+                tan[n] = tan[n] + t;
+                bitan[n] = bitan[n] + b;
+            }
+        }
+    }
+    tangents_.resize(norms_.size());
+    for (int i = 0; i < (int)norms_.size(); i++) {
+        Vec3f n = normal(i);
+        Vec3f t = (tan[i] - n * (n * tan[i])).normalize();
+        float w = ((n ^ t) * bitan[i]) < 0.f ? -1.f : 1.f;
+        tangents_[i] = Vec4f(t.x, t.y, t.z, w);
+    }
+}
+
+Vec4f Model::tangent(int iface, int nvert) {
+    int idx = faces_[iface][nvert][2];
+    if (idx < 0 || idx >= (int)tangents_.size()) return Vec4f(0.f, 0.f, 0.f, 1.f);
+    return tangents_[idx];
 }
 
+Vec3i Model::corner(int iface, int nvert) {
+    return faces_[iface][nvert];
+}
+
+Vec2f Model::texcoord(int idx) {
+    if (idx < 0 || idx >= (int)uv_.size()) return Vec2f();
+    return uv_[idx];
+}
+
+Vec3f Model::normal(int idx) {
+    if (idx < 0 || idx >= (int)norms_.size()) return Vec3f();
+    return norms_[idx];
+}
+
+size_t Model::bytes() {
+    size_t n = verts_.capacity() * sizeof(Vec3f) + norms_.capacity() * sizeof(Vec3f) + uv_.capacity() * sizeof(Vec2f);
+    n += faces_.capacity() * sizeof(std::vector<Vec3i>);
+    for (int i = 0; i < (int)faces_.size(); i++) n += faces_[i].capacity() * sizeof(Vec3i);
+    return n;
+}
+
+void Model::release_geometry(bool bake_normals) {
+    for (int m = 0; bake_normals && m < (int)materials_.size(); m++) object_normal_map(m);
+    std::vector<Vec3f>().swap(verts_);
+    std::vector<std::vector<Vec3i> >().swap(faces_);
+    std::vector<Vec3f>().swap(norms_);
+    std::vector<Vec2f>().swap(uv_);
+    std::vector<Vec4f>().swap(tangents_);
+}
+
+// Renumbers one attribute stream (0 - positions, 1 - uvs, 2 - normals) in first-use order.
+template <class T>
+static void reorder_stream(std::vector<std::vector<Vec3i> >& faces, int attr, std::vector<T>& stream) {
+    std::vector<int> indices;
+    indices.reserve(faces.size() * 3);
+    for (int i = 0; i < (int)faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            int idx = faces[i][j][attr];
+            if (idx < 0 || idx >= (int)stream.size()) return;
+            indices.push_back(idx);
+        }
+    }
+    std::vector<int> remap;
+    optimize_vertex_fetch(indices, (int)stream.size(), remap);
+    std::vector<T> reordered(stream.size());
+    for (int v = 0; v < (int)stream.size(); v++) reordered[remap[v]] = stream[v];
+    stream.swap(reordered);
+    for (int i = 0; i < (int)faces.size(); i++)
+        for (int j = 0; j < 3; j++) faces[i][j][attr] = indices[i * 3 + j];
+}
+
+void Model::optimize(int cache_size) {
+    std::vector<int> indices;
+    indices.reserve(faces_.size() * 3);
+    for (int i = 0; i < (int)faces_.size(); i++) {
+        if (faces_[i].size() != 3) {
+            std::cerr << "# optimize: skipped, mesh is not triangulated" << std::endl;
+            return;
+        }
+        for (int j = 0; j < 3; j++) indices.push_back(faces_[i][j][0]);
+    }
+    float before = acmr(indices, nverts(), cache_size);
+
+    // triangles are reordered inside their material range only
+    std::vector<std::vector<Vec3i> > faces(faces_.size());
+    for (int r = 0; r < (int)ranges_.size(); r++) {
+        const MaterialRange& range = ranges_[r];
+        std::vector<int> sub(indices.begin() + range.first * 3, indices.begin() + (range.first + range.count) * 3);
+        std::vector<int> order = optimize_vertex_cache(sub, nverts(), cache_size);
+        for (int i = 0; i < (int)order.size(); i++) faces[range.first + i].swap(faces_[range.first + order[i]]);
+    }
+    faces_.swap(faces);
+
+    reorder_stream(faces_, 0, verts_);
+    reorder_stream(faces_, 1, uv_);
+    reorder_stream(faces_, 2, norms_);
+    compute_tangents();
+
+    for (int i = 0; i < (int)faces_.size(); i++)
+        for (int j = 0; j < 3; j++) indices[i * 3 + j] = faces_[i][j][0];
+    std::cerr << "# acmr " << before << " -> " << acmr(indices, nverts(), cache_size) << " (cache " << cache_size << ")" << std::endl;
+}
@@ -2,8 +2,30 @@
 #define __MODEL_H__
 
 #include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
 #include "geometry.h"
 #include "tgaimage.h"
+#include "material_texture.h"
+
+class ThreadPool;
+
+// Textures are not loaded with the model: shaders fetch them from TextureCache on first use.
+struct Material {
+    std::string name;
+    std::string diffuse_path;
+    std::string normal_path;
+    std::string specular_path;
+    bool tangent_normals;  // normal map is in tangent space (MTL bump maps); <name>_nm.tga is in object space
+};
+
+// Faces are stored grouped by material, so each range can be drawn as one batch.
+struct MaterialRange {
+    int material;
+    int first;
+    int count;
+};
 
 class Model {
 private:
@@ -11,18 +33,50 @@ private:
     std::vector<std::vector<Vec3i> > faces_;
     std::vector<Vec3f> norms_;
     std::vector<Vec2f> uv_;
-    TGAImage diffusemap_;
-    void load_texture(std::string filename, const char* suffix, TGAImage& img);
+    std::vector<Vec4f> tangents_;  // per normal index, w is the handedness of the bitangent
+    std::vector<Material> materials_;
+    std::vector<MaterialRange> ranges_;
+    std::vector<std::shared_ptr<MaterialTexture> > packed_;
+    std::vector<std::shared_ptr<TGAImage> > baked_;
+    std::mutex packed_mutex_;
+    bool rigid_;
+    void default_texture(std::string filename, const char* suffix, std::string& path);
+    void load_mtl(const std::string& filename);
+    void compute_tangents();
+    std::shared_ptr<TGAImage> object_normal_map_locked(int material);
 public:
-    Model(const char* filename);
+    // With a pool, the OBJ text is parsed in parallel chunks that are merged in file order.
+    Model(const char* filename, ThreadPool* pool = nullptr);
     ~Model();
     int nverts();
     int nfaces();
     Vec3f norm(int iface, int nvert);
     Vec3f vert(int i);
-    Vec2i uv(int iface, int nvert);
-    TGAColor diffuse(Vec2i uv);
-    std::vector<int> face(int idx);
+    Vec3i corner(int iface, int nvert);
+    Vec2f texcoord(int idx);
+    Vec3f normal(int idx);
+    Vec4f tangent(int iface, int nvert);
+    size_t bytes();
+    int nmaterials();
+    Material& material(int i);
+    std::shared_ptr<TGAImage> diffuse_map(int material);
+    std::shared_ptr<TGAImage> normal_map(int material);
+    std::shared_ptr<TGAImage> specular_map(int material);
+    std::shared_ptr<TGAImage> object_normal_map(int material);
+    std::shared_ptr<MaterialTexture> material_texture(int material);
+    // Rigid models get their tangent-space normal maps baked to object space when first used.
+    // Deformable ones keep them and shade with a per-pixel tangent frame.
+    void set_rigid(bool rigid);
+    bool rigid();
+    int face_material(int iface);
+    int nranges();
+    MaterialRange range(int i);
+    int face_size(int iface);  // corners of the face
+    void optimize(int cache_size = 16);
+    // Frees positions, normals, uvs, tangents and faces once a CompactMesh has taken them over; materials
+    // and ranges stay. Object-space normal maps are baked from the geometry, so with `bake_normals` the
+    // ones a textured render will use are made first. Call set_rigid() before, not after.
+    void release_geometry(bool bake_normals);
 };
 
 #endif //__MODEL_H__
\ No newline at end of file
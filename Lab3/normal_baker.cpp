@@ -0,0 +1,99 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "normal_baker.h"
+
+namespace {
+
+Vec3f decode(const TGAColor& c) {
+    return Vec3f(c.bgra[2] / 255.f * 2.f - 1.f, c.bgra[1] / 255.f * 2.f - 1.f, c.bgra[0] / 255.f * 2.f - 1.f);
+}
+
+unsigned char encode(float v) {
+    return (unsigned char)std::min(255.f, std::max(0.f, (v * .5f + .5f) * 255.f + .5f));
+}
+
+void bake_triangle(Model& model, int iface, const int* corner, TGAImage& tangent_map, TGAImage& out, std::vector<bool>& covered) {
+    int w = out.get_width();
+    int h = out.get_height();
+    Vec2f uv[3];
+    Vec3f n[3];
+    Vec4f t[3];
+    for (int j = 0; j < 3; j++) {
+        Vec2f tc = model.texcoord(model.corner(iface, corner[j]).y);
+        uv[j] = Vec2f(tc.x * w, tc.y * h);
+        n[j] = model.norm(iface, corner[j]);
+        t[j] = model.tangent(iface, corner[j]);
+    }
+    float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+    if (std::fabs(area) < 1e-12f) return;
+
+    int xmin = std::max(0, (int)std::floor(std::min(uv[0].x, std::min(uv[1].x, uv[2].x))));
+    int ymin = std::max(0, (int)std::floor(std::min(uv[0].y, std::min(uv[1].y, uv[2].y))));
+    int xmax = std::min(w - 1, (int)std::ceil(std::max(uv[0].x, std::max(uv[1].x, uv[2].x))));
+    int ymax = std::min(h - 1, (int)std::ceil(std::max(uv[0].y, std::max(uv[1].y, uv[2].y))));
+    for (int y = ymin; y <= ymax; y++) {
+        for (int x = xmin; x <= xmax; x++) {
+            Vec2f p(x + .5f, y + .5f);
+            float b1 = ((p.x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (p.y - uv[0].y)) / area;
+            float b2 = ((uv[1].x - uv[0].x) * (p.y - uv[0].y) - (p.x - uv[0].x) * (uv[1].y - uv[0].y)) / area;
+            float b0 = 1.f - b1 - b2;
+            if (b0 < -1e-4f || b1 < -1e-4f || b2 < -1e-4f) continue;
+
+            Vec3f nn = (n[0] * b0 + n[1] * b1 + n[2] * b2).normalize();
+            Vec3f tt(t[0].x * b0 + t[1].x * b1 + t[2].x * b2,
+                t[0].y * b0 + t[1].y * b1 + t[2].y * b2,
+                t[0].z * b0 + t[1].z * b1 + t[2].z * b2);
+            tt = (tt - nn * (nn * tt)).normalize();
+            Vec3f bb = (nn ^ tt) * (t[0].w * b0 + t[1].w * b1 + t[2].w * b2 < 0.f ? -1.f : 1.f);
+
+            // x, y are texel coordinates in uv space, v up; image rows go down
+            int th = tangent_map.get_height();
+            Vec3f ts = decode(tangent_map.get(x * tangent_map.get_width() / w, th - 1 - y * th / h));
+            Vec3f os = (tt * ts.x + bb * ts.y + nn * ts.z).normalize();
+            out.set(x, h - 1 - y, TGAColor(encode(os.x), encode(os.y), encode(os.z)));
+            covered[x + (h - 1 - y) * w] = true;
+        }
+    }
+}
+
+void dilate(TGAImage& out, std::vector<bool>& covered) {
+    int w = out.get_width();
+    int h = out.get_height();
+    std::vector<bool> next = covered;
+    // right, left, up, down, with rows going down
+    const int dx[4] = { 1, -1, 0, 0 };
+    const int dy[4] = { 0, 0, -1, 1 };
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (covered[x + y * w]) continue;
+            for (int k = 0; k < 4; k++) {
+                int nx = x + dx[k], ny = y + dy[k];
+                if (nx < 0 || ny < 0 || nx >= w || ny >= h || !covered[nx + ny * w]) continue;
+                out.set(x, y, out.get(nx, ny));
+                next[x + y * w] = true;
+                break;
+            }
+        }
+    }
+    covered.swap(next);
+}
+
+}
+
+void bake_object_space_normals(Model& model, int material, TGAImage& tangent_map, TGAImage& out) {
+    out = TGAImage(tangent_map.get_width(), tangent_map.get_height(), TGAImage::RGB);
+    std::vector<bool> covered(out.get_width() * out.get_height(), false);
+    for (int r = 0; r < model.nranges(); r++) {
+        MaterialRange range = model.range(r);
+        if (range.material != material) continue;
+        for (int i = range.first; i < range.first + range.count; i++) {
+            int n = model.face_size(i);
+            for (int k = 1; k + 1 < n; k++) {
+                int fan[3] = { 0, k, k + 1 };
+                bake_triangle(model, i, fan, tangent_map, out, covered);
+            }
+        }
+    }
+    for (int pass = 0; pass < 2; pass++) dilate(out, covered);
+}
@@ -0,0 +1,13 @@
+#ifndef __NORMAL_BAKER_H__
+#define __NORMAL_BAKER_H__
+
+#include "model.h"
+#include "tgaimage.h"
+
+// Rewrites the tangent-space normal map of `material` as an object-space map, using the per-vertex
+// tangent frames of the faces drawn with that material. Only valid while the mesh does not deform.
+// Texels no face covers are filled from their neighbours, so that nearest sampling at uv seams
+// does not pick up garbage. UVs outside [0,1] are clipped, tiled normal maps can't be baked.
+void bake_object_space_normals(Model& model, int material, TGAImage& tangent_map, TGAImage& out);
+
+#endif //__NORMAL_BAKER_H__
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include "poster.h"
+#include "rasterizer.h"
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+bool render_poster(Model& model, ThreadPool& pool, CompactMesh* mesh, const RenderOptions& options,
+    const char* filename, int width, int height, int tile) {
+    tile = std::max(tile_size, tile);
+    TGARegionWriter writer;
+    if (!writer.open(filename, width, height, TGAImage::RGB)) return false;
+    Renderer renderer(model, pool, mesh, options);
+    renderer.resize(width, height);
+    renderer.set_camera(Renderer::default_camera(width, height));
+
+    int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TGAImage written;  // the previous window, on its way to the file
+    TaskHandle write;
+    bool ok = true;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            int x = tx * tile, y = ty * tile;
+            renderer.set_window(x, y, tile, tile);
+            renderer.render();
+            if (write) pool.wait(write);
+            written.swap(renderer.image());
+            write = pool.submit([&written, &writer, &ok, x, y] {
+                if (!writer.write(written, x, y)) ok = false;
+            });
+        }
+        std::cerr << "# poster row " << ty + 1 << "/" << tiles_y << std::endl;
+    }
+    if (write) pool.wait(write);
+    if (!writer.close()) ok = false;
+    std::chrono::duration<double> s = std::chrono::steady_clock::now() - start;
+
+    const double mb = 1024. * 1024.;
+    // color and depth of the window being drawn, color of the one being written
+    double buffers = (double)tile * tile * (2 * TGAImage::RGB + sizeof(float)) / mb;
+    double full = (double)width * height * (TGAImage::RGB + sizeof(float)) / mb;
+    std::cerr << "# poster " << width << "x" << height << " in " << tiles_x * tiles_y << " tiles of " << tile << "x" << tile
+        << ": " << s.count() << " s, " << (double)width * height / (s.count() * 1e6) << " Mpix/s, tile buffers " << buffers
+        << " MB, a full frame would need " << full << " MB";
+#if !defined(_WIN32)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) std::cerr << ", peak resident " << usage.ru_maxrss / 1024. << " MB";
+#endif
+    std::cerr << std::endl;
+    return ok;
+}
+
+bool merge_crops(const char* filename, int width, int height, const std::vector<const char*>& crops) {
+    struct Rect {
+        int x, y, w, h;
+    };
+    std::vector<Rect> placed;
+    long long covered = 0;
+    TGARegionWriter writer;
+    TGAImage crop;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < crops.size(); i++) {
+        TGA_Header header;
+        if (!crop.read_tga_file(crops[i], &header)) return false;
+        Rect r = { header.x_origin, header.y_origin, crop.get_width(), crop.get_height() };
+        if (r.x + r.w > width || r.y + r.h > height) {
+            std::cerr << crops[i] << " at " << r.x << "," << r.y << " doesn't fit a " << width << "x" << height << " frame" << std::endl;
+            return false;
+        }
+        for (size_t k = 0; k < placed.size(); k++) {
+            const Rect& o = placed[k];
+            if (r.x < o.x + o.w && o.x < r.x + r.w && r.y < o.y + o.h && o.y < r.y + r.h) {
+                std::cerr << crops[i] << " overlaps " << crops[k] << std::endl;
+                return false;
+            }
+        }
+        if (i == 0 && !writer.open(filename, width, height, crop.get_bytespp())) return false;
+        if (!writer.write(crop, r.x, r.y)) {
+            std::cerr << "can't place " << crops[i] << std::endl;
+            return false;
+        }
+        placed.push_back(r);
+        covered += (long long)r.w * r.h;
+    }
+    if (covered != (long long)width * height) {
+        std::cerr << "the crops cover " << covered << " of " << (long long)width * height << " pixels" << std::endl;
+        return false;
+    }
+    if (!writer.close()) return false;
+    std::chrono::duration<double> s = std::chrono::steady_clock::now() - start;
+    std::cerr << "# merged " << crops.size() << " crops into " << width << "x" << height << " in " << s.count() << " s" << std::endl;
+    return true;
+}
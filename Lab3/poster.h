@@ -0,0 +1,22 @@
+#ifndef __POSTER_H__
+#define __POSTER_H__
+
+#include <vector>
+#include "model.h"
+#include "compact_mesh.h"
+#include "renderer.h"
+#include "thread_pool.h"
+
+// Renders a width x height frame (default camera and light) as tile x tile windows, each with its own
+// image and depth buffer, and writes every finished window in place into an uncompressed TGA while
+// the next one renders. Memory follows the tile size, not the frame size; the pixels are those of a
+// single full-frame render. Returns false when the file can't be written.
+bool render_poster(Model& model, ThreadPool& pool, CompactMesh* mesh, const RenderOptions& options,
+    const char* filename, int width, int height, int tile);
+
+// Assembles the crops of one width x height frame, each rendered with --crop (maybe in another
+// process) and placed by its header origin, into an uncompressed TGA, one crop in memory at a time.
+// The crops must cover the frame exactly once.
+bool merge_crops(const char* filename, int width, int height, const std::vector<const char*>& crops);
+
+#endif //__POSTER_H__
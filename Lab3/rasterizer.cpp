@@ -0,0 +1,163 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "rasterizer.h"
+
+namespace {
+
+// Faces binned per task before the tile pass.
+const int bin_grain = 8192;
+
+Vec3f barycentric(const Vec3f* pts, const Vec3f& P) {
+    Vec3f u = (Vec3f(pts[2].x - pts[0].x, pts[1].x - pts[0].x, pts[0].x - P.x) ^
+        Vec3f(pts[2].y - pts[0].y, pts[1].y - pts[0].y, pts[0].y - P.y));
+    if (std::fabs(u.z) < 1e-2f) return Vec3f(-1.f, 1.f, 1.f);
+    return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+}
+
+void flush(FragmentBatch& batch, const Varyings& in, const IShader& shader, TGAImage& image, float* zbuffer) {
+    if (!batch.count) return;
+    TGAColor colors[8];
+    int discard = shader.fragment8(in, batch, colors);
+    int width = image.get_width();
+    for (int i = 0; i < batch.count; i++) {
+        if (discard & (1 << i)) continue;
+        zbuffer[batch.x[i] + batch.y[i] * width] = batch.z[i];
+        image.set(batch.x[i], batch.y[i], colors[i]);
+    }
+    batch.count = 0;
+}
+
+// Pixel bounding box of the triangle, clamped to the rectangle.
+void bounds(const Vec3f* pts, int x0, int y0, int x1, int y1, Vec2f& bboxmin, Vec2f& bboxmax) {
+    bboxmin = Vec2f(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    bboxmax = Vec2f(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+    for (int i = 0; i < 3; i++) {
+        bboxmin.x = std::max((float)x0, std::min(bboxmin.x, pts[i].x));
+        bboxmin.y = std::max((float)y0, std::min(bboxmin.y, pts[i].y));
+        bboxmax.x = std::min((float)x1, std::max(bboxmax.x, pts[i].x));
+        bboxmax.y = std::min((float)y1, std::max(bboxmax.y, pts[i].y));
+    }
+}
+
+}
+
+// A triangle never covers a pixel twice, so deferring the depth write to the end of the batch doesn't
+// change the result.
+void triangle(const Varyings& in, const IShader& shader, TGAImage& image, float* zbuffer, bool batched,
+    int x0, int y0, int x1, int y1, int ox, int oy) {
+    const Vec3f* pts = in.screen;
+    int width = image.get_width();
+    int height = image.get_height();
+    FragmentBatch batch;
+    batch.count = 0;
+    Vec2f bboxmin, bboxmax;
+    bounds(pts, x0, y0, x1, y1, bboxmin, bboxmax);
+
+    for (int x = (int)bboxmin.x; x <= (int)bboxmax.x; x++) {
+        for (int y = (int)bboxmin.y; y <= (int)bboxmax.y; y++) {
+            Vec3f P((float)x + 0.5f, (float)y + 0.5f, 0.f);
+            Vec3f bc = barycentric(pts, P);
+            if (bc.x < 0.f || bc.y < 0.f || bc.z < 0.f) continue;
+
+            float z = pts[0].z * bc.x +
+                pts[1].z * bc.y +
+                pts[2].z * bc.z;
+
+            int idx = (x - ox) + (y - oy) * width;
+            if (idx < 0 || idx >= width * height) continue;
+
+            if (zbuffer[idx] < z) {
+                if (batched) {
+                    int i = batch.count++;
+                    batch.bar[0][i] = bc.x;
+                    batch.bar[1][i] = bc.y;
+                    batch.bar[2][i] = bc.z;
+                    batch.z[i] = z;
+                    batch.x[i] = x - ox;
+                    batch.y[i] = y - oy;
+                    if (batch.count == 8) flush(batch, in, shader, image, zbuffer);
+                    continue;
+                }
+                TGAColor color;
+                if (!shader.fragment(in, bc, color)) {
+                    zbuffer[idx] = z;
+                    image.set(x - ox, y - oy, color);
+                }
+            }
+        }
+    }
+    if (batched) {
+        for (int i = batch.count; i < 8; i++) batch.bar[0][i] = batch.bar[1][i] = batch.bar[2][i] = 0.f;
+        flush(batch, in, shader, image, zbuffer);
+    }
+}
+
+void rasterize(const Varyings* tris, int ntris, const IShader& shader, TGAImage& image, float* zbuffer, bool batched,
+    ThreadPool& pool, FrameArenas& arenas, int ox, int oy) {
+    int width = image.get_width();
+    int height = image.get_height();
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int ntiles = tiles_x * tiles_y;
+    int nchunks = (ntris + bin_grain - 1) / bin_grain;
+
+    // faces of chunk c touching tile t, in face order: bins[c].faces[bins[c].start[t] .. bins[c].start[t + 1])
+    struct Bins {
+        int* start;
+        int* faces;
+    };
+    Bins* bins = arenas.local().allocate_array<Bins>(nchunks);
+    pool.parallel_for(0, nchunks, 1, [&](int first, int last) {
+        Arena& arena = arenas.local();
+        for (int c = first; c < last; c++) {
+            int begin = c * bin_grain;
+            int n = std::min(ntris, begin + bin_grain) - begin;
+            int* rect = arena.allocate_array<int>(n * 4);  // tile range tx0, ty0, tx1, ty1 per face
+            int* start = arena.allocate_array<int>(ntiles + 1);
+            for (int i = 0; i < n; i++) {
+                int* r = rect + i * 4;
+                Vec2f bboxmin, bboxmax;
+                bounds(tris[begin + i].screen, ox, oy, ox + width - 1, oy + height - 1, bboxmin, bboxmax);
+                // compared as the pixel loop truncates them, so a window edge culls like a tile edge
+                if ((int)bboxmin.x > (int)bboxmax.x || (int)bboxmin.y > (int)bboxmax.y) {
+                    r[0] = r[1] = 0;
+                    r[2] = r[3] = -1;
+                    continue;
+                }
+                r[0] = ((int)bboxmin.x - ox) / tile_size;
+                r[1] = ((int)bboxmin.y - oy) / tile_size;
+                r[2] = ((int)bboxmax.x - ox) / tile_size;
+                r[3] = ((int)bboxmax.y - oy) / tile_size;
+                for (int ty = r[1]; ty <= r[3]; ty++)
+                    for (int tx = r[0]; tx <= r[2]; tx++) start[ty * tiles_x + tx + 1]++;
+            }
+            for (int t = 0; t < ntiles; t++) start[t + 1] += start[t];
+            int* faces = arena.allocate_array<int>(start[ntiles]);
+            int* fill = arena.allocate_array<int>(ntiles);
+            for (int i = 0; i < n; i++) {
+                const int* r = rect + i * 4;
+                for (int ty = r[1]; ty <= r[3]; ty++)
+                    for (int tx = r[0]; tx <= r[2]; tx++) {
+                        int t = ty * tiles_x + tx;
+                        faces[start[t] + fill[t]++] = begin + i;
+                    }
+            }
+            bins[c].start = start;
+            bins[c].faces = faces;
+        }
+    });
+
+    pool.parallel_for(0, ntiles, 1, [&](int first, int last) {
+        for (int t = first; t < last; t++) {
+            int x0 = (t % tiles_x) * tile_size;
+            int y0 = (t / tiles_x) * tile_size;
+            int x1 = std::min(width, x0 + tile_size) - 1;
+            int y1 = std::min(height, y0 + tile_size) - 1;
+            for (int c = 0; c < nchunks; c++) {
+                for (int k = bins[c].start[t]; k < bins[c].start[t + 1]; k++)
+                    triangle(tris[bins[c].faces[k]], shader, image, zbuffer, batched, x0 + ox, y0 + oy, x1 + ox, y1 + oy, ox, oy);
+            }
+        }
+    });
+}
@@ -0,0 +1,26 @@
+#ifndef __RASTERIZER_H__
+#define __RASTERIZER_H__
+
+#include <vector>
+#include "tgaimage.h"
+#include "shader.h"
+#include "thread_pool.h"
+#include "arena.h"
+
+// Screen is split into square tiles of this many pixels, each rasterized as one task.
+const int tile_size = 64;
+
+// Draws the part of one triangle inside the pixel rectangle [x0, x1] x [y0, y1]. Fragments that pass
+// the depth test are shaded 8 at a time unless `batched` is off. `image` and `zbuffer` hold the screen
+// pixels from (ox, oy) on.
+void triangle(const Varyings& in, const IShader& shader, TGAImage& image, float* zbuffer, bool batched,
+    int x0, int y0, int x1, int y1, int ox = 0, int oy = 0);
+
+// Draws all triangles in order. Triangles are binned into tiles and the tiles are drawn in parallel;
+// inside a tile the order is kept, so the result doesn't depend on the thread count. The bins live
+// in the frame arenas. With an origin (ox, oy), only the screen window of the image's size there is
+// drawn; pixels are computed in screen coordinates, so they come out the same as in a full frame.
+void rasterize(const Varyings* tris, int ntris, const IShader& shader, TGAImage& image, float* zbuffer, bool batched,
+    ThreadPool& pool, FrameArenas& arenas, int ox = 0, int oy = 0);
+
+#endif //__RASTERIZER_H__
@@ -0,0 +1,109 @@
+#include <limits>
+#include <algorithm>
+#include <chrono>
+#include "renderer.h"
+#include "vertex_stage.h"
+#include "rasterizer.h"
+
+namespace {
+
+// Center and scale that bring the model's bounding box into the unit sphere around the origin. A compact
+// mesh has the same box, and it is there even when the model has released its geometry.
+void fit_unit_sphere(Model& model, CompactMesh* mesh, Vec3f& center, float& scale) {
+    Vec3f bbmin(std::numeric_limits<float>::max(),
+        std::numeric_limits<float>::max(),
+        std::numeric_limits<float>::max());
+    Vec3f bbmax(-std::numeric_limits<float>::max(),
+        -std::numeric_limits<float>::max(),
+        -std::numeric_limits<float>::max());
+    if (mesh) mesh->bounds(bbmin, bbmax);
+    for (int i = 0; i < model.nverts(); i++) {
+        Vec3f v = model.vert(i);
+        bbmin.x = std::min(bbmin.x, v.x);
+        bbmin.y = std::min(bbmin.y, v.y);
+        bbmin.z = std::min(bbmin.z, v.z);
+        bbmax.x = std::max(bbmax.x, v.x);
+        bbmax.y = std::max(bbmax.y, v.y);
+        bbmax.z = std::max(bbmax.z, v.z);
+    }
+    center = Vec3f((bbmin.x + bbmax.x) * 0.5f,
+        (bbmin.y + bbmax.y) * 0.5f,
+        (bbmin.z + bbmax.z) * 0.5f);
+    Vec3f extent = Vec3f(bbmax.x - bbmin.x,
+        bbmax.y - bbmin.y,
+        bbmax.z - bbmin.z);
+    float radius = std::max(extent.x, std::max(extent.y, extent.z)) * 0.5f;
+    scale = (radius > 1e-6f) ? (1.0f / radius) : 1.0f;
+}
+
+}
+
+Renderer::Renderer(Model& model, ThreadPool& pool, CompactMesh* mesh, const RenderOptions& options)
+    : model_(model), mesh_(mesh), pool_(pool), options_(options), shader_(), ranges_(), nfaces_(0), arenas_(pool),
+    width_(0), height_(0), window_x_(0), window_y_(0), window_w_(0), window_h_(0), image_(), zbuffer_(), camera_(), light_dir_(Vec3f(1.f, -1.f, 1.f).normalize()),
+    vertex_ms_(0.), frame_ms_(0.) {
+    Vec3f center;
+    float scale;
+    fit_unit_sphere(model_, mesh_, center, scale);
+    // the matrices are set from the camera at every frame
+    Matrix identity = Matrix::identity(4);
+    if (options_.textured)
+        shader_.reset(new TexturedPhongShader(model_, identity, identity, identity, light_dir_, Vec3f(), center, scale, options_.packed));
+    else
+        shader_.reset(new PhongShader(model_, identity, identity, identity, light_dir_, Vec3f(), center, scale));
+    shader_->uniform_specular = SpecularPower(32.f, options_.specular);
+    shader_->compact = mesh_;
+
+    nfaces_ = mesh_ ? mesh_->nfaces() : model_.nfaces();
+    for (int r = 0; r < (mesh_ ? mesh_->nranges() : model_.nranges()); r++)
+        ranges_.push_back(mesh_ ? mesh_->range(r) : model_.range(r));
+    // textures are fetched (or packed) on first bind, keep that out of the frame time
+    for (size_t r = 0; r < ranges_.size(); r++) shader_->bind_material(ranges_[r].material);
+}
+
+Camera Renderer::default_camera(int width, int height) {
+    return Camera(
+        Vec3f(0.f, 0.f, 5.f),
+        Vec3f(0.f, 0.f, 0.f),
+        Vec3f(0.f, 1.f, 0.f),
+        60.f,
+        (float)width / (float)height,
+        0.1f,
+        100.f
+    );
+}
+
+void Renderer::resize(int width, int height) {
+    width_ = width;
+    height_ = height;
+    set_window(0, 0, width, height);
+}
+
+void Renderer::set_window(int x, int y, int w, int h) {
+    window_x_ = std::max(0, std::min(x, width_));
+    window_y_ = std::max(0, std::min(y, height_));
+    window_w_ = std::max(0, std::min(w, width_ - window_x_));
+    window_h_ = std::max(0, std::min(h, height_ - window_y_));
+}
+
+void Renderer::render() {
+    shader_->set_camera(camera_.viewMatrix(), camera_.projectionMatrix(), Matrix::viewport(0, 0, width_, height_, depth),
+        camera_.position());
+    shader_->set_light(light_dir_);
+    if (image_.get_width() != window_w_ || image_.get_height() != window_h_ || image_.get_bytespp() != TGAImage::RGB) {
+        image_ = TGAImage(window_w_, window_h_, TGAImage::RGB);
+        zbuffer_.resize((size_t)window_w_ * window_h_);
+    }
+    image_.clear();
+    std::fill(zbuffer_.begin(), zbuffer_.end(), -std::numeric_limits<float>::infinity());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Varyings* varyings = arenas_.local().allocate_array<Varyings>(nfaces_);
+    run_vertex_stage(*shader_, ranges_, varyings, pool_);
+    std::chrono::duration<double, std::milli> vertex = std::chrono::steady_clock::now() - start;
+    rasterize(varyings, nfaces_, *shader_, image_, zbuffer_.data(), options_.batched, pool_, arenas_, window_x_, window_y_);
+    arenas_.reset();
+    std::chrono::duration<double, std::milli> frame = std::chrono::steady_clock::now() - start;
+    vertex_ms_ = vertex.count();
+    frame_ms_ = frame.count();
+}
@@ -0,0 +1,89 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include <vector>
+#include <memory>
+#include "tgaimage.h"
+#include "model.h"
+#include "compact_mesh.h"
+#include "camera.h"
+#include "shader.h"
+#include "specular.h"
+#include "thread_pool.h"
+#include "arena.h"
+
+// Shading choices fixed for the lifetime of a Renderer.
+struct RenderOptions {
+    bool textured;
+    bool packed;    // textured: one MaterialTexel fetch instead of three image samples
+    bool batched;   // shade 8 fragments at a time
+    SpecularMode specular;
+    RenderOptions() : textured(false), packed(true), batched(true), specular(SPECULAR_SQUARING) {}
+};
+
+// Everything one frame needs besides the model: framebuffer, depth buffer, shader and frame arenas.
+// A renderer draws one frame at a time, but any number of them can draw concurrently, on their own
+// threads, over the same Model and ThreadPool. Buffers are allocated by render() for the window to
+// draw, kept between frames and only reallocated when its size changes.
+class Renderer {
+public:
+    static const int depth = 255;
+
+    // Textures of every material are bound here, so the first frame doesn't load them.
+    // `model` and `mesh` must outlive the renderer.
+    Renderer(Model& model, ThreadPool& pool, CompactMesh* mesh = nullptr, const RenderOptions& options = RenderOptions());
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    // Sets the frame size and draws all of it.
+    void resize(int width, int height);
+    // Draws only the window [x, x + w) x [y, y + h) of the frame: image() and zbuffer() are the window's
+    // size and hold the same pixels as that part of a full frame. Clamped to the frame.
+    void set_window(int x, int y, int w, int h);
+    void set_camera(const Camera& camera) { camera_ = camera; }
+    void set_light(const Vec3f& light_dir) {
+        light_dir_ = light_dir;
+        light_dir_.normalize();
+    }
+
+    // Draws into image() and zbuffer(); the timings are those of the last frame.
+    void render();
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int window_x() const { return window_x_; }
+    int window_y() const { return window_y_; }
+    TGAImage& image() { return image_; }
+    const float* zbuffer() const { return zbuffer_.data(); }
+    double vertex_ms() const { return vertex_ms_; }
+    double frame_ms() const { return frame_ms_; }
+    int nfaces() const { return nfaces_; }
+    // The camera the command-line tool has always used, looking at the unit-size model from +z.
+    static Camera default_camera(int width, int height);
+
+private:
+    Model& model_;
+    CompactMesh* mesh_;
+    ThreadPool& pool_;
+    RenderOptions options_;
+    std::unique_ptr<PhongBase> shader_;
+    std::vector<MaterialRange> ranges_;
+    int nfaces_;
+    FrameArenas arenas_;
+
+    int width_;
+    int height_;
+    int window_x_;
+    int window_y_;
+    int window_w_;
+    int window_h_;
+    TGAImage image_;
+    std::vector<float> zbuffer_;
+    Camera camera_;
+    Vec3f light_dir_;
+
+    double vertex_ms_;
+    double frame_ms_;
+};
+
+#endif //__RENDERER_H__
@@ -0,0 +1,421 @@
+#include <iostream>
+#include "server.h"
+
+#if defined(_WIN32)
+
+int run_server(const char* socket_path, ThreadPool& pool, const RenderOptions& options, bool rigid,
+    int max_models, int workers) {
+    std::cerr << "server mode needs Unix domain sockets, not available in this build" << std::endl;
+    return 1;
+}
+
+#else
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <list>
+#include <set>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "batch.h"
+
+namespace {
+
+// A resident model and the idle Renderers drawing it. Renderers are declared after the model so they
+// are destroyed first.
+struct CachedModel {
+    std::string path;
+    std::once_flag loaded;
+    std::unique_ptr<Model> model;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Renderer> > idle;
+};
+
+// Models by path, least recently used dropped first. An evicted model lives on until the requests
+// holding it are done.
+class ModelCache {
+public:
+    ModelCache(ThreadPool& pool, const RenderOptions& options, bool rigid, int capacity)
+        : pool_(pool), options_(options), rigid_(rigid), capacity_(std::max(1, capacity)), mutex_(), lru_(),
+        hits_(0), misses_(0), evictions_(0) {}
+
+    // Parses the file on a miss; the cache lock is not held meanwhile, so hits on other models go on.
+    std::shared_ptr<CachedModel> get(const std::string& path) {
+        std::shared_ptr<CachedModel> entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::list<std::shared_ptr<CachedModel> >::iterator it = lru_.begin(); it != lru_.end(); ++it) {
+                if ((*it)->path != path) continue;
+                entry = *it;
+                lru_.erase(it);
+                break;
+            }
+            if (entry) hits_++;
+            else {
+                misses_++;
+                entry = std::make_shared<CachedModel>();
+                entry->path = path;
+            }
+            lru_.push_front(entry);
+            while ((int)lru_.size() > capacity_) {
+                lru_.pop_back();
+                evictions_++;
+            }
+        }
+        try {
+            std::call_once(entry->loaded, [&] {
+                entry->model.reset(new Model(path.c_str(), &pool_));
+                entry->model->set_rigid(rigid_);
+            });
+        }
+        catch (...) {
+            // the flag stays unset, so a later request parses again
+            drop(entry);
+            throw;
+        }
+        if (!entry->model->nfaces()) {
+            drop(entry);
+            return std::shared_ptr<CachedModel>();
+        }
+        return entry;
+    }
+
+    std::unique_ptr<Renderer> acquire(CachedModel& entry) {
+        {
+            std::lock_guard<std::mutex> lock(entry.mutex);
+            if (!entry.idle.empty()) {
+                std::unique_ptr<Renderer> r = std::move(entry.idle.back());
+                entry.idle.pop_back();
+                return r;
+            }
+        }
+        return std::unique_ptr<Renderer>(new Renderer(*entry.model, pool_, nullptr, options_));
+    }
+
+    // Renderers that drew a large frame are freed rather than kept, buffers and arenas included: a
+    // Renderer never gives memory back, and the next request on it may be small.
+    void release(CachedModel& entry, std::unique_ptr<Renderer> renderer) {
+        if ((long long)renderer->width() * renderer->height() > max_idle_pixels) return;
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        entry.idle.push_back(std::move(renderer));
+    }
+
+    void counters(long& hits, long& misses, long& evictions, int& resident) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hits = hits_;
+        misses = misses_;
+        evictions = evictions_;
+        resident = (int)lru_.size();
+    }
+
+private:
+    static const long long max_idle_pixels = 1LL << 22;
+
+    void drop(const std::shared_ptr<CachedModel>& entry) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lru_.remove(entry);
+    }
+
+    ThreadPool& pool_;
+    RenderOptions options_;
+    bool rigid_;
+    int capacity_;
+    std::mutex mutex_;
+    std::list<std::shared_ptr<CachedModel> > lru_;  // most recently used first
+    long hits_;
+    long misses_;
+    long evictions_;
+};
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool reply(int fd, const std::string& payload) {
+    std::string head = "ok " + std::to_string(payload.size()) + "\n";
+    return write_all(fd, head.data(), head.size()) && write_all(fd, payload.data(), payload.size());
+}
+
+bool reply_error(int fd, const std::string& message) {
+    std::string line = "error " + message + "\n";
+    return write_all(fd, line.data(), line.size());
+}
+
+// Line reader over a socket; `pending` keeps what was read past the newline.
+bool read_line(int fd, std::string& pending, std::string& line) {
+    for (;;) {
+        size_t eol = pending.find('\n');
+        if (eol != std::string::npos) {
+            line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            return true;
+        }
+        char buf[4096];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        pending.append(buf, n);
+    }
+}
+
+class Server {
+public:
+    Server(ThreadPool& pool, const RenderOptions& options, bool rigid, int max_models)
+        : pool_(pool), cache_(pool, options, rigid, max_models), mutex_(), ready_(), connections_(), open_(), listen_fd_(-1),
+        stop_(false), active_(0), requests_(0), errors_(0), stats_mutex_(), latency_(), next_latency_(0) {}
+
+    int run(const char* socket_path, int workers) {
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (listen_fd_ < 0 || strlen(socket_path) >= sizeof(addr.sun_path)) {
+            std::cerr << "can't create socket " << socket_path << std::endl;
+            return 1;
+        }
+        strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+        unlink(socket_path);
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 64) < 0) {
+            std::cerr << "can't listen on " << socket_path << ": " << strerror(errno) << std::endl;
+            close(listen_fd_);
+            return 1;
+        }
+        std::cerr << "# serving on " << socket_path << " with " << workers << " workers" << std::endl;
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < workers; i++) threads.push_back(std::thread(&Server::worker, this));
+        for (;;) {
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stop_) {
+                close(fd);
+                break;
+            }
+            connections_.push_back(fd);
+            open_.insert(fd);
+            ready_.notify_one();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            // idle connections would keep their workers in recv() forever
+            for (std::set<int>::iterator it = open_.begin(); it != open_.end(); ++it) shutdown(*it, SHUT_RD);
+            ready_.notify_all();
+        }
+        for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+        close(listen_fd_);
+        unlink(socket_path);
+        std::cerr << "# " << stats();
+        return 0;
+    }
+
+private:
+    void worker() {
+        for (;;) {
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return stop_ || !connections_.empty(); });
+                if (connections_.empty()) return;
+                fd = connections_.front();
+                connections_.pop_front();
+            }
+            serve(fd);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                open_.erase(fd);
+            }
+            close(fd);
+        }
+    }
+
+    void serve(int fd) {
+        std::string pending, line;
+        while (read_line(fd, pending, line)) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::istringstream iss(line);
+            std::string command;
+            iss >> command;
+            bool ok;
+            if (command == "render") {
+                active_++;
+                ok = render(fd, iss);
+                active_--;
+                requests_++;
+                std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+                record_latency(ms.count());
+            }
+            else if (command == "stats") ok = reply(fd, stats());
+            else if (command == "quit") {
+                reply(fd, std::string());
+                stop();
+                return;
+            }
+            else if (command.empty()) continue;
+            else ok = reply_error(fd, "unknown command " + command);
+            if (!ok) return;
+        }
+    }
+
+    // Returns false only when the connection is lost.
+    bool render(int fd, std::istream& args) {
+        std::string path, rest;
+        args >> path;
+        std::getline(args, rest);
+        RenderJob job;
+        std::string error;
+        if (path.empty() || !parse_job(rest, job, error)) {
+            errors_++;
+            return reply_error(fd, path.empty() ? "missing model path" : error);
+        }
+        std::ostringstream size;
+        size << job.width << "x" << job.height;
+        if ((long long)job.width * job.height > max_pixels) {
+            errors_++;
+            return reply_error(fd, "size " + size.str() + " is over the limit of " + std::to_string(max_pixels) + " pixels");
+        }
+        if (!below_cwd(path)) {
+            errors_++;
+            return reply_error(fd, "model " + path + " must be a relative path without ..");
+        }
+        if (job.output != "-" && !below_cwd(job.output)) {
+            errors_++;
+            return reply_error(fd, "output " + job.output + " must be - or a relative path without ..");
+        }
+        std::shared_ptr<CachedModel> entry;
+        bool written;
+        std::string payload;
+        try {
+            entry = cache_.get(path);
+            if (!entry) {
+                errors_++;
+                return reply_error(fd, "can't load model " + path);
+            }
+            std::unique_ptr<Renderer> renderer = cache_.acquire(*entry);
+            renderer->resize(job.width, job.height);
+            renderer->set_camera(job.camera());
+            renderer->set_light(job.light_dir);
+            renderer->render();
+            if (job.output == "-") {
+                std::ostringstream out;
+                written = renderer->image().write_tga(out, true, &pool_);
+                payload = out.str();
+            }
+            else written = renderer->image().write_tga_file(job.output.c_str(), true, &pool_);
+            cache_.release(*entry, std::move(renderer));
+        }
+        catch (const std::bad_alloc&) {
+            // thrown here or in a pool task drawing the frame; the renderer goes with its buffers
+            // instead of back to the cache
+            errors_++;
+            return reply_error(fd, entry ? "out of memory for a " + size.str() + " frame" : "out of memory loading " + path);
+        }
+        if (!written) {
+            errors_++;
+            return reply_error(fd, "can't write " + job.output);
+        }
+        return reply(fd, payload);
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        shutdown(listen_fd_, SHUT_RDWR);
+    }
+
+    void record_latency(double ms) {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        if (latency_.size() < latency_window) latency_.push_back(ms);
+        else latency_[next_latency_] = ms;
+        next_latency_ = (next_latency_ + 1) % latency_window;
+    }
+
+    std::string stats() {
+        long hits, misses, evictions;
+        int resident;
+        cache_.counters(hits, misses, evictions, resident);
+        size_t queued;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued = connections_.size();
+        }
+        std::vector<double> latency;
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            latency = latency_;
+        }
+        std::ostringstream out;
+        out << "queue " << queued << " active " << active_ << " requests " << requests_ << " errors " << errors_
+            << " models " << resident << " hits " << hits << " misses " << misses << " evictions " << evictions
+            << " hit_rate " << (hits + misses ? hits / (double)(hits + misses) : 0.)
+            << " p50_ms " << percentile(latency, 50.) << " p99_ms " << percentile(latency, 99.) << "\n";
+        return out.str();
+    }
+
+    // Models and outputs must be below the server's working directory, so a client can't read or
+    // overwrite files elsewhere.
+    static bool below_cwd(const std::string& path) {
+        if (path.empty() || path[0] == '/') return false;
+        std::istringstream parts(path);
+        std::string part;
+        while (std::getline(parts, part, '/')) {
+            if (part == "..") return false;
+        }
+        return true;
+    }
+
+    // Percentiles are over the most recent requests only.
+    static const size_t latency_window = 4096;
+    // Largest frame a request may ask for, so that one request can't take all the memory.
+    static const long long max_pixels = 1LL << 26;
+
+    ThreadPool& pool_;
+    ModelCache cache_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<int> connections_;   // accepted, waiting for a worker
+    std::set<int> open_;            // accepted and not closed yet
+    int listen_fd_;
+    bool stop_;
+    std::atomic<int> active_;
+    std::atomic<long> requests_;
+    std::atomic<long> errors_;
+    std::mutex stats_mutex_;
+    std::vector<double> latency_;
+    size_t next_latency_;
+};
+
+}
+
+int run_server(const char* socket_path, ThreadPool& pool, const RenderOptions& options, bool rigid,
+    int max_models, int workers) {
+    Server server(pool, options, rigid, max_models);
+    return server.run(socket_path, std::max(1, workers));
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "renderer.h"
+#include "thread_pool.h"
+
+// Long-running render service on a Unix domain socket. Clients send one request per line:
+//   render <model.obj> <job>   job as in a batch manifest (see batch.h); output "-" returns the image,
+//                              any other output is written below the server's working directory;
+//                              the model and output paths must be relative without ".."; at most
+//                              2^26 pixels
+//   stats                      counters as text
+//   quit                       stops the server once the running requests are done
+// Every reply is either "ok <n>\n" followed by n bytes of payload (the TGA file, the stats text, or
+// nothing when the image went to a path) or "error <message>\n".
+//
+// Parsed models stay resident in an LRU cache of `max_models` entries, along with the Renderers that
+// drew them (up to 2^22 pixels), so a repeated request neither parses nor allocates frame buffers. Connections are served
+// by `workers` threads; each frame is still split over `pool`.
+int run_server(const char* socket_path, ThreadPool& pool, const RenderOptions& options, bool rigid,
+    int max_models, int workers);
+
+#endif //__SERVER_H__
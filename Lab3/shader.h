@@ -0,0 +1,294 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "compact_mesh.h"
+#include "material_texture.h"
+#include "geometry8.h"
+#include "specular.h"
+
+// Up to 8 fragments of one triangle in SoA form; lanes past `count` are padding.
+struct FragmentBatch {
+    float bar[3][8];
+    float z[8];
+    int x[8];
+    int y[8];
+    int count;
+};
+
+// Vertex stage output for one triangle: screen positions for the rasterizer plus the varyings
+// the fragment stage interpolates. Shaders only fill what they use.
+struct Varyings {
+    Vec3f screen[3];
+    Vec3f world_pos[3];
+    Vec3f normal[3];
+    Vec2f uv[3];
+    Vec4f tangent[3];
+    int material;
+};
+
+// vertex() and fragment() are const and keep all per-triangle data in Varyings, so one shader can
+// run on many threads at once. bind_material() is the only call that changes the shader: it is made
+// once per material before the frame, and fragment() picks the material of Varyings::material.
+struct IShader {
+    virtual ~IShader() {}
+    virtual void vertex(int iface, int nthvert, Varyings& out) const = 0;
+    virtual bool fragment(const Varyings& in, const Vec3f& bar, TGAColor& color) const = 0;
+    virtual void bind_material(int /*material*/) {}
+
+    // Shades a whole batch, returns the bit mask of discarded fragments.
+    // The default runs fragment() lane by lane; SIMD shaders override it.
+    virtual int fragment8(const Varyings& in, const FragmentBatch& batch, TGAColor* colors) const {
+        int discard = 0;
+        for (int i = 0; i < batch.count; i++) {
+            if (fragment(in, Vec3f(batch.bar[0][i], batch.bar[1][i], batch.bar[2][i]), colors[i])) discard |= 1 << i;
+        }
+        return discard;
+    }
+};
+
+// Uniforms, vertex stage and lighting shared by the Phong shaders.
+struct PhongBase : public IShader {
+    Model& model;
+    CompactMesh* compact;
+
+    Matrix uniform_MVP;  // viewport * projection * modelview, one multiply per vertex
+
+    Vec3f  uniform_light_dir;
+    Vec3f  uniform_eye;
+
+    Vec3f  uniform_center;
+    float  uniform_scale;
+
+    SpecularPower uniform_specular;
+
+    PhongBase(Model& m,
+        const Matrix& modelView,
+        const Matrix& projection,
+        const Matrix& viewport,
+        const Vec3f& light_dir,
+        const Vec3f& eye,
+        const Vec3f& center,
+        float scale)
+        : model(m)
+        , compact(nullptr)
+        , uniform_MVP(multiply_simd(viewport, multiply_simd(projection, modelView)))
+        , uniform_light_dir(light_dir)
+        , uniform_eye(eye)
+        , uniform_center(center)
+        , uniform_scale(scale)
+        , uniform_specular(32.f) {
+        uniform_light_dir.normalize();
+    }
+
+    // Camera and light may change between frames; call these only while no frame is being drawn.
+    void set_camera(const Matrix& modelView, const Matrix& projection, const Matrix& viewport, const Vec3f& eye) {
+        uniform_MVP = multiply_simd(viewport, multiply_simd(projection, modelView));
+        uniform_eye = eye;
+    }
+
+    void set_light(const Vec3f& light_dir) {
+        uniform_light_dir = light_dir;
+        uniform_light_dir.normalize();
+    }
+
+    void vertex(int iface, int nthvert, Varyings& out) const override {
+        Vec3f v_raw, n;
+        if (compact) {
+            int idx = compact->index(iface, nthvert);
+            v_raw = compact->vert(idx);
+            n = compact->norm(idx);
+            out.uv[nthvert] = compact->uv(idx);
+        }
+        else {
+            Vec3i corner = model.corner(iface, nthvert);
+            v_raw = model.vert(corner.x);
+            n = model.norm(iface, nthvert);
+            out.uv[nthvert] = model.texcoord(corner.y);
+        }
+
+        Vec3f v = (v_raw - uniform_center) * uniform_scale;
+        out.world_pos[nthvert] = v;
+        out.normal[nthvert] = n;
+
+        Vec4f screen = uniform_MVP * Vec4f(v.x, v.y, v.z, 1.f);
+        float w = (std::fabs(screen.w) > 1e-6f) ? screen.w : 1.f;
+        out.screen[nthvert] = Vec3f(screen.x / w, screen.y / w, screen.z / w);
+    }
+
+    float lighting(const Vec3f& p, const Vec3f& n, float spec_weight) const {
+        Vec3f L = uniform_light_dir;
+        Vec3f V = (uniform_eye - p).normalize();
+        Vec3f R = (n * (2.f * (n * L)) - L).normalize();
+
+        float ambient = 0.2f;
+        float diff = std::max(0.f, n * L);
+        float spec = uniform_specular(std::max(0.f, R * V));
+
+        return ambient + diff + spec_weight * spec;
+    }
+};
+
+// Untextured Phong, with a SIMD fragment8.
+struct PhongShader : public PhongBase {
+    PhongShader(Model& m,
+        const Matrix& modelView,
+        const Matrix& projection,
+        const Matrix& viewport,
+        const Vec3f& light_dir,
+        const Vec3f& eye,
+        const Vec3f& center,
+        float scale)
+        : PhongBase(m, modelView, projection, viewport, light_dir, eye, center, scale) {
+    }
+
+    bool fragment(const Varyings& in, const Vec3f& bar, TGAColor& color) const override {
+        Vec3f p = in.world_pos[0] * bar.x +
+            in.world_pos[1] * bar.y +
+            in.world_pos[2] * bar.z;
+
+        Vec3f n = (in.normal[0] * bar.x +
+            in.normal[1] * bar.y +
+            in.normal[2] * bar.z).normalize();
+
+        TGAColor base(200, 200, 200);
+        color = base * lighting(p, n, 0.4f);
+        return false;
+    }
+
+    int fragment8(const Varyings& in, const FragmentBatch& batch, TGAColor* colors) const override {
+        float8 b0 = float8::load(batch.bar[0]);
+        float8 b1 = float8::load(batch.bar[1]);
+        float8 b2 = float8::load(batch.bar[2]);
+        Vec3x8 p = interpolate(in.world_pos, b0, b1, b2);
+        Vec3x8 n = normalize(interpolate(in.normal, b0, b1, b2));
+
+        Vec3x8 L(uniform_light_dir);
+        Vec3x8 V = normalize(Vec3x8(uniform_eye) - p);
+        float8 nl = dot(n, L);
+        Vec3x8 R = normalize(n * (float8(2.f) * nl) - L);
+
+        float8 diff = max(float8(0.f), nl);
+        float8 spec = uniform_specular(max(float8(0.f), dot(R, V)));
+
+        float intensity[8];
+        (float8(0.2f) + diff + float8(0.4f) * spec).store(intensity);
+        TGAColor base(200, 200, 200);
+        for (int i = 0; i < batch.count; i++) colors[i] = base * intensity[i];
+        return 0;
+    }
+};
+
+// Phong shading with the material maps: diffuse color, normal and specular weight.
+// Packed mode reads one MaterialTexel per fragment, otherwise the three TGAImages are sampled separately.
+// Normal maps of rigid models are in object space; a tangent frame is only built per pixel for deformable ones.
+struct TexturedPhongShader : public PhongBase {
+    struct Binding {
+        std::shared_ptr<MaterialTexture> material_tex;
+        std::shared_ptr<TGAImage> diffuse_tex;
+        std::shared_ptr<TGAImage> normal_tex;
+        std::shared_ptr<TGAImage> specular_tex;
+        bool tangent_frame;  // the normal map is in tangent space (deformable meshes)
+    };
+
+    bool packed;
+    std::vector<Binding> bindings;  // by material index
+
+    TexturedPhongShader(Model& m,
+        const Matrix& modelView,
+        const Matrix& projection,
+        const Matrix& viewport,
+        const Vec3f& light_dir,
+        const Vec3f& eye,
+        const Vec3f& center,
+        float scale,
+        bool packed_maps = true)
+        : PhongBase(m, modelView, projection, viewport, light_dir, eye, center, scale)
+        , packed(packed_maps)
+        , bindings() {
+    }
+
+    void vertex(int iface, int nthvert, Varyings& out) const override {
+        out.tangent[nthvert] = compact ? Vec4f(0.f, 0.f, 0.f, 1.f) : model.tangent(iface, nthvert);
+        PhongBase::vertex(iface, nthvert, out);
+    }
+
+    void bind_material(int material) override {
+        if (material >= (int)bindings.size()) bindings.resize(material + 1);
+        Binding& b = bindings[material];
+        if (packed) {
+            b.material_tex = model.material_texture(material);
+            b.tangent_frame = b.material_tex->tangent_space();
+        }
+        else {
+            b.diffuse_tex = model.diffuse_map(material);
+            b.normal_tex = model.object_normal_map(material);
+            b.specular_tex = model.specular_map(material);
+            b.tangent_frame = model.material(material).tangent_normals && !model.rigid();
+        }
+    }
+
+    // Tangent-space normal to object space with the interpolated per-vertex frame.
+    static Vec3f tangent_to_object(const Vec4f* tangent, const Vec3f& ts, const Vec3f& n, const Vec3f& bar) {
+        Vec3f t(tangent[0].x * bar.x + tangent[1].x * bar.y + tangent[2].x * bar.z,
+            tangent[0].y * bar.x + tangent[1].y * bar.y + tangent[2].y * bar.z,
+            tangent[0].z * bar.x + tangent[1].z * bar.y + tangent[2].z * bar.z);
+        t = t - n * (n * t);
+        if (t * t < 1e-12f) return n;
+        t.normalize();
+        float w = tangent[0].w * bar.x + tangent[1].w * bar.y + tangent[2].w * bar.z;
+        Vec3f b = (n ^ t) * (w < 0.f ? -1.f : 1.f);
+        return (t * ts.x + b * ts.y + n * ts.z).normalize();
+    }
+
+    // v goes up, image rows go down.
+    static TGAColor sample(TGAImage* img, const Vec2f& uv) {
+        float u = uv.x - std::floor(uv.x);
+        float v = uv.y - std::floor(uv.y);
+        return img->get(std::min((int)(u * img->get_width()), img->get_width() - 1),
+            img->get_height() - 1 - std::min((int)(v * img->get_height()), img->get_height() - 1));
+    }
+
+    bool fragment(const Varyings& in, const Vec3f& bar, TGAColor& color) const override {
+        Vec3f p = in.world_pos[0] * bar.x +
+            in.world_pos[1] * bar.y +
+            in.world_pos[2] * bar.z;
+        Vec2f uv = in.uv[0] * bar.x + in.uv[1] * bar.y + in.uv[2] * bar.z;
+
+        const Binding& b = bindings[in.material];
+        TGAColor base(255, 255, 255);
+        Vec3f n;
+        float spec_weight = 0.f;
+        if (packed) {
+            const MaterialTexel& t = b.material_tex->fetch(uv);
+            base = TGAColor(t.diffuse, 4);
+            n = b.material_tex->has_normal() ? MaterialTexture::normal(t) : Vec3f();
+            spec_weight = MaterialTexture::specular(t);
+        }
+        else {
+            if (b.diffuse_tex) base = sample(b.diffuse_tex.get(), uv);
+            if (b.normal_tex) {
+                TGAColor c = sample(b.normal_tex.get(), uv);
+                n = Vec3f(c.bgra[2] / 255.f * 2.f - 1.f, c.bgra[1] / 255.f * 2.f - 1.f, c.bgra[0] / 255.f * 2.f - 1.f).normalize();
+            }
+            if (b.specular_tex) spec_weight = sample(b.specular_tex.get(), uv).bgra[0] / 255.f;
+        }
+        if (n * n == 0.f || b.tangent_frame) {
+            Vec3f vn = (in.normal[0] * bar.x +
+                in.normal[1] * bar.y +
+                in.normal[2] * bar.z).normalize();
+            n = n * n == 0.f ? vn : tangent_to_object(in.tangent, n, vn, bar);
+        }
+
+        color = base * lighting(p, n, 0.6f * spec_weight);
+        return false;
+    }
+};
+
+#endif //__SHADER_H__
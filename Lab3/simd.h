@@ -0,0 +1,210 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+// 8-wide float vector: one AVX register, two SSE2 registers, or a plain array.
+// Define LAB3_NO_SIMD to force the scalar fallback.
+
+#if !defined(LAB3_NO_SIMD) && defined(__AVX__)
+#include <immintrin.h>
+#define LAB3_SIMD_AVX
+#elif !defined(LAB3_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define LAB3_SIMD_SSE2
+#endif
+
+// Byte shuffles (pshufb) for the bulk image operations; every AVX target has them too.
+#if !defined(LAB3_NO_SIMD) && (defined(__SSSE3__) || defined(__AVX__))
+#include <tmmintrin.h>
+#define LAB3_SIMD_SSSE3
+#endif
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+struct float8 {
+#if defined(LAB3_SIMD_AVX)
+    __m256 v;
+    float8() : v(_mm256_setzero_ps()) {}
+    float8(float s) : v(_mm256_set1_ps(s)) {}
+    explicit float8(__m256 x) : v(x) {}
+    static float8 load(const float* p) { return float8(_mm256_loadu_ps(p)); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    float first() const { return _mm256_cvtss_f32(v); }
+
+    float8 operator+(const float8& o) const { return float8(_mm256_add_ps(v, o.v)); }
+    float8 operator-(const float8& o) const { return float8(_mm256_sub_ps(v, o.v)); }
+    float8 operator*(const float8& o) const { return float8(_mm256_mul_ps(v, o.v)); }
+    float8 operator/(const float8& o) const { return float8(_mm256_div_ps(v, o.v)); }
+    // comparisons return all-ones / all-zeros lanes
+    float8 operator<(const float8& o) const { return float8(_mm256_cmp_ps(v, o.v, _CMP_LT_OQ)); }
+    float8 operator>(const float8& o) const { return float8(_mm256_cmp_ps(v, o.v, _CMP_GT_OQ)); }
+    float8 operator&(const float8& o) const { return float8(_mm256_and_ps(v, o.v)); }
+    float8 operator|(const float8& o) const { return float8(_mm256_or_ps(v, o.v)); }
+
+    friend float8 min(const float8& a, const float8& b) { return float8(_mm256_min_ps(a.v, b.v)); }
+    friend float8 max(const float8& a, const float8& b) { return float8(_mm256_max_ps(a.v, b.v)); }
+    friend float8 sqrt(const float8& a) { return float8(_mm256_sqrt_ps(a.v)); }
+    friend float8 rsqrt_estimate(const float8& a) { return float8(_mm256_rsqrt_ps(a.v)); }
+    friend float8 select(const float8& mask, const float8& a, const float8& b) { return float8(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+    friend int movemask(const float8& mask) { return _mm256_movemask_ps(mask.v); }
+#elif defined(LAB3_SIMD_SSE2)
+    __m128 lo, hi;
+    float8() : lo(_mm_setzero_ps()), hi(_mm_setzero_ps()) {}
+    float8(float s) : lo(_mm_set1_ps(s)), hi(_mm_set1_ps(s)) {}
+    float8(__m128 l, __m128 h) : lo(l), hi(h) {}
+    static float8 load(const float* p) { return float8(_mm_loadu_ps(p), _mm_loadu_ps(p + 4)); }
+    void store(float* p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+    float first() const { return _mm_cvtss_f32(lo); }
+
+    float8 operator+(const float8& o) const { return float8(_mm_add_ps(lo, o.lo), _mm_add_ps(hi, o.hi)); }
+    float8 operator-(const float8& o) const { return float8(_mm_sub_ps(lo, o.lo), _mm_sub_ps(hi, o.hi)); }
+    float8 operator*(const float8& o) const { return float8(_mm_mul_ps(lo, o.lo), _mm_mul_ps(hi, o.hi)); }
+    float8 operator/(const float8& o) const { return float8(_mm_div_ps(lo, o.lo), _mm_div_ps(hi, o.hi)); }
+    float8 operator<(const float8& o) const { return float8(_mm_cmplt_ps(lo, o.lo), _mm_cmplt_ps(hi, o.hi)); }
+    float8 operator>(const float8& o) const { return float8(_mm_cmpgt_ps(lo, o.lo), _mm_cmpgt_ps(hi, o.hi)); }
+    float8 operator&(const float8& o) const { return float8(_mm_and_ps(lo, o.lo), _mm_and_ps(hi, o.hi)); }
+    float8 operator|(const float8& o) const { return float8(_mm_or_ps(lo, o.lo), _mm_or_ps(hi, o.hi)); }
+
+    friend float8 min(const float8& a, const float8& b) { return float8(_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)); }
+    friend float8 max(const float8& a, const float8& b) { return float8(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)); }
+    friend float8 sqrt(const float8& a) { return float8(_mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi)); }
+    friend float8 rsqrt_estimate(const float8& a) { return float8(_mm_rsqrt_ps(a.lo), _mm_rsqrt_ps(a.hi)); }
+    friend float8 select(const float8& mask, const float8& a, const float8& b) {
+        return float8(_mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo)),
+            _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi)));
+    }
+    friend int movemask(const float8& mask) { return _mm_movemask_ps(mask.lo) | (_mm_movemask_ps(mask.hi) << 4); }
+#else
+    float v[8];
+    float8() { for (int i = 0; i < 8; i++) v[i] = 0.f; }
+    float8(float s) { for (int i = 0; i < 8; i++) v[i] = s; }
+    static float8 load(const float* p) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = p[i]; return r; }
+    void store(float* p) const { for (int i = 0; i < 8; i++) p[i] = v[i]; }
+    float first() const { return v[0]; }
+
+    float8 operator+(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] + o.v[i]; return r; }
+    float8 operator-(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] - o.v[i]; return r; }
+    float8 operator*(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] * o.v[i]; return r; }
+    float8 operator/(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] / o.v[i]; return r; }
+    float8 operator<(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = mask_bits(v[i] < o.v[i]); return r; }
+    float8 operator>(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = mask_bits(v[i] > o.v[i]); return r; }
+    float8 operator&(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = bits(bits(v[i]) & bits(o.v[i])); return r; }
+    float8 operator|(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = bits(bits(v[i]) | bits(o.v[i])); return r; }
+
+    friend float8 min(const float8& a, const float8& b) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+    friend float8 max(const float8& a, const float8& b) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+    friend float8 sqrt(const float8& a) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = std::sqrt(a.v[i]); return r; }
+    friend float8 rsqrt_estimate(const float8& a) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = 1.f / std::sqrt(a.v[i]); return r; }
+    friend float8 select(const float8& mask, const float8& a, const float8& b) {
+        float8 r;
+        for (int i = 0; i < 8; i++) r.v[i] = bits(mask.v[i]) ? a.v[i] : b.v[i];
+        return r;
+    }
+    friend int movemask(const float8& mask) {
+        int m = 0;
+        for (int i = 0; i < 8; i++) m |= (bits(mask.v[i]) >> 31) << i;
+        return m;
+    }
+
+    static unsigned int bits(float f) { unsigned int u; std::memcpy(&u, &f, 4); return u; }
+    static float bits(unsigned int u) { float f; std::memcpy(&f, &u, 4); return f; }
+    static float mask_bits(bool b) { return bits(b ? 0xffffffffu : 0u); }
+#endif
+};
+
+// 1/sqrt(x): the hardware estimate (12 bits) refined by one Newton step to ~22 bits.
+inline float8 rsqrt(const float8& x) {
+    float8 y = rsqrt_estimate(x);
+    return y * (float8(1.5f) - float8(0.5f) * x * y * y);
+}
+
+// Polynomial approximations of log2 (x > 0, max abs error 3e-5) and exp2 (relative error 3e-7),
+// good enough for lighting terms where std::pow is too slow.
+namespace simd_detail {
+const float log2_c[5] = { 1.44182587f, -0.70868292f, 0.41542472f, -0.19442637f, 0.04588722f };
+const float exp2_c[5] = { 0.69315274f, 0.24015320f, 0.05582816f, 0.00898899f, 0.00187663f };
+
+#if defined(LAB3_SIMD_AVX) || defined(LAB3_SIMD_SSE2)
+inline __m128 poly5(__m128 t, const float* c) {
+    __m128 p = _mm_set1_ps(c[4]);
+    for (int k = 3; k >= 0; k--) p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(c[k]));
+    return _mm_mul_ps(p, t);
+}
+
+inline __m128 log2_approx4(__m128 x) {
+    __m128i i = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(i, 23), _mm_set1_epi32(127)));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+    return _mm_add_ps(e, poly5(_mm_sub_ps(m, _mm_set1_ps(1.f)), log2_c));
+}
+
+inline __m128 exp2_approx4(__m128 y) {
+    y = _mm_max_ps(_mm_min_ps(y, _mm_set1_ps(127.f)), _mm_set1_ps(-126.f));
+    __m128i yi = _mm_cvttps_epi32(y);
+    __m128 fi = _mm_cvtepi32_ps(yi);
+    __m128 adjust = _mm_cmpgt_ps(fi, y);  // truncation rounds negatives up
+    fi = _mm_sub_ps(fi, _mm_and_ps(adjust, _mm_set1_ps(1.f)));
+    yi = _mm_cvttps_epi32(fi);
+    __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(yi, _mm_set1_epi32(127)), 23));
+    __m128 frac = poly5(_mm_sub_ps(y, fi), exp2_c);
+    return _mm_mul_ps(scale, _mm_add_ps(frac, _mm_set1_ps(1.f)));
+}
+#endif
+}
+
+inline float log2_approx(float x) {
+    unsigned int i;
+    std::memcpy(&i, &x, 4);
+    float e = (float)((int)(i >> 23) - 127);
+    i = (i & 0x007FFFFFu) | 0x3F800000u;
+    float m;
+    std::memcpy(&m, &i, 4);
+    float t = m - 1.f, p = simd_detail::log2_c[4];
+    for (int k = 3; k >= 0; k--) p = p * t + simd_detail::log2_c[k];
+    return e + p * t;
+}
+
+inline float exp2_approx(float y) {
+    y = std::min(127.f, std::max(-126.f, y));
+    float fi = std::floor(y);
+    float t = y - fi, p = simd_detail::exp2_c[4];
+    for (int k = 3; k >= 0; k--) p = p * t + simd_detail::exp2_c[k];
+    unsigned int bits = (unsigned int)((int)fi + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, 4);
+    return scale * (p * t + 1.f);
+}
+
+#if defined(LAB3_SIMD_AVX)
+inline float8 log2_approx(const float8& x) {
+    __m128 lo = simd_detail::log2_approx4(_mm256_castps256_ps128(x.v));
+    __m128 hi = simd_detail::log2_approx4(_mm256_extractf128_ps(x.v, 1));
+    return float8(_mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+}
+inline float8 exp2_approx(const float8& y) {
+    __m128 lo = simd_detail::exp2_approx4(_mm256_castps256_ps128(y.v));
+    __m128 hi = simd_detail::exp2_approx4(_mm256_extractf128_ps(y.v, 1));
+    return float8(_mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+}
+#elif defined(LAB3_SIMD_SSE2)
+inline float8 log2_approx(const float8& x) {
+    return float8(simd_detail::log2_approx4(x.lo), simd_detail::log2_approx4(x.hi));
+}
+inline float8 exp2_approx(const float8& y) {
+    return float8(simd_detail::exp2_approx4(y.lo), simd_detail::exp2_approx4(y.hi));
+}
+#else
+inline float8 log2_approx(const float8& x) {
+    float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = log2_approx(x.v[i]);
+    return r;
+}
+inline float8 exp2_approx(const float8& y) {
+    float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = exp2_approx(y.v[i]);
+    return r;
+}
+#endif
+
+#endif //__SIMD_H__
@@ -0,0 +1,31 @@
+#include <cmath>
+#include <string.h>
+#include "specular.h"
+
+SpecularPower::SpecularPower(float exponent, SpecularMode mode)
+    : exponent_(exponent), mode_(mode), iexponent_((int)exponent), top_bit_(0), lut_() {
+    if (mode_ == SPECULAR_SQUARING && (exponent_ != (float)iexponent_ || iexponent_ < 0)) mode_ = SPECULAR_EXP2;
+    for (int bit = 1; bit > 0 && bit <= iexponent_; bit <<= 1)
+        if (iexponent_ & bit) top_bit_ = bit;
+    if (mode_ == SPECULAR_LUT) {
+        lut_.resize(lut_size + 2);  // one extra entry so that x == 1 can interpolate too
+        for (int i = 0; i <= lut_size; i++) lut_[i] = std::pow(i / (float)lut_size, exponent_);
+        lut_[lut_size + 1] = lut_[lut_size];
+    }
+}
+
+static const char* mode_names[] = { "pow", "lut", "squaring", "exp2" };
+
+const char* SpecularPower::name(SpecularMode mode) {
+    return mode_names[mode];
+}
+
+bool SpecularPower::parse(const char* name, SpecularMode& mode) {
+    for (int i = 0; i < 4; i++) {
+        if (!strcmp(name, mode_names[i])) {
+            mode = (SpecularMode)i;
+            return true;
+        }
+    }
+    return false;
+}
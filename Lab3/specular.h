@@ -0,0 +1,101 @@
+#ifndef __SPECULAR_H__
+#define __SPECULAR_H__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "simd.h"
+
+enum SpecularMode {
+    SPECULAR_POW,       // std::pow, the reference
+    SPECULAR_LUT,       // linear interpolation in a table over [0,1]
+    SPECULAR_SQUARING,  // exponentiation by squaring, integer exponents only
+    SPECULAR_EXP2       // exp2(e * log2(x)) with polynomial approximations
+};
+
+// x^exponent for x in [0,1], the specular term of the Phong model.
+class SpecularPower {
+private:
+    float exponent_;
+    SpecularMode mode_;
+    int iexponent_;
+    int top_bit_;  // highest set bit of iexponent_, squaring goes left to right
+    std::vector<float> lut_;
+public:
+    static const int lut_size = 1024;
+
+    // SPECULAR_SQUARING with a fractional exponent falls back to SPECULAR_EXP2.
+    SpecularPower(float exponent = 32.f, SpecularMode mode = SPECULAR_SQUARING);
+    float exponent() const { return exponent_; }
+    SpecularMode mode() const { return mode_; }
+
+    float operator()(float x) const;
+    float8 operator()(const float8& x) const;
+
+    static const char* name(SpecularMode mode);
+    static bool parse(const char* name, SpecularMode& mode);
+};
+
+// Inline, the evaluators sit in the innermost shading loop.
+inline float SpecularPower::operator()(float x) const {
+    x = std::min(1.f, std::max(0.f, x));
+    switch (mode_) {
+    case SPECULAR_LUT: {
+        float f = x * lut_size;
+        int i = (int)f;
+        float t = f - i;
+        return lut_[i] + (lut_[i + 1] - lut_[i]) * t;
+    }
+    case SPECULAR_SQUARING: {
+        if (!iexponent_) return 1.f;
+        float r = x;
+        for (int bit = top_bit_ >> 1; bit; bit >>= 1) {
+            r *= r;
+            if (iexponent_ & bit) r *= x;
+        }
+        return r;
+    }
+    case SPECULAR_EXP2:
+        return x > 0.f ? exp2_approx(exponent_ * log2_approx(x)) : 0.f;
+    default:
+        return std::pow(x, exponent_);
+    }
+}
+
+inline float8 SpecularPower::operator()(const float8& xs) const {
+    float8 x = min(float8(1.f), max(float8(0.f), xs));
+    switch (mode_) {
+    case SPECULAR_SQUARING: {
+        if (!iexponent_) return float8(1.f);
+        float8 r = x;
+        for (int bit = top_bit_ >> 1; bit; bit >>= 1) {
+            r = r * r;
+            if (iexponent_ & bit) r = r * x;
+        }
+        return r;
+    }
+    case SPECULAR_EXP2: {
+        float8 r = exp2_approx(float8(exponent_) * log2_approx(x));
+        return select(x > float8(0.f), r, float8(0.f));
+    }
+#if defined(LAB3_SIMD_AVX) && defined(__AVX2__)
+    case SPECULAR_LUT: {
+        float8 f = x * float8((float)lut_size);
+        __m256i i = _mm256_cvttps_epi32(f.v);
+        float8 t = f - float8(_mm256_cvtepi32_ps(i));
+        float8 a(_mm256_i32gather_ps(&lut_[0], i, 4));
+        float8 b(_mm256_i32gather_ps(&lut_[1], i, 4));
+        return a + (b - a) * t;
+    }
+#endif
+    default: {
+        // std::pow, and the table without AVX2 gathers, are evaluated lane by lane
+        float v[8];
+        x.store(v);
+        for (int i = 0; i < 8; i++) v[i] = (*this)(v[i]);
+        return float8::load(v);
+    }
+    }
+}
+
+#endif //__SPECULAR_H__
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <chrono>
+#include <limits>
+#include "texture_cache.h"
+
+TextureCache::TextureCache() : mutex_(), images_(), lru_(), budget_(std::numeric_limits<size_t>::max()), loads_(0), stats_() {
+}
+
+TextureCache& TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+std::shared_ptr<TGAImage> TextureCache::get(const std::string& path) {
+    std::promise<std::shared_ptr<TGAImage> > loaded;
+    std::shared_future<std::shared_ptr<TGAImage> > cached;
+    long load = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<std::string, Entry>::iterator it = images_.find(path);
+        if (it != images_.end()) {
+            stats_.hits++;
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            cached = it->second.image;
+        }
+        else {
+            // in flight until read; failures are remembered too, so a missing file is only probed once
+            stats_.misses++;
+            load = ++loads_;
+            lru_.push_front(path);
+            Entry& e = images_[path];
+            e.image = loaded.get_future().share();
+            e.bytes = 0;
+            e.load = load;
+            e.lru = lru_.begin();
+        }
+    }
+    if (cached.valid()) return cached.get();  // waits if another thread is still reading the file
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::shared_ptr<TGAImage> img;
+    try {
+        img = std::make_shared<TGAImage>();
+        if (!img->read_tga_file(path.c_str())) img.reset();
+    }
+    catch (...) {
+        loaded.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<std::string, Entry>::iterator it = images_.find(path);
+        if (it != images_.end() && it->second.load == load) {
+            lru_.erase(it->second.lru);
+            images_.erase(it);
+        }
+        throw;
+    }
+    loaded.set_value(img);
+    std::cerr << "texture file " << path << " loading " << (img ? "ok" : "failed") << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!img) stats_.failures++;
+    stats_.load_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    // the entry may have been evicted or cleared while the file was read
+    std::map<std::string, Entry>::iterator it = images_.find(path);
+    if (it != images_.end() && it->second.load == load && img) {
+        it->second.bytes = (size_t)img->get_width() * img->get_height() * img->get_bytespp();
+        stats_.bytes_resident += it->second.bytes;
+        evict();
+    }
+    return img;
+}
+
+// Drops least recently used images until the budget is met; the most recent one always stays.
+void TextureCache::evict() {
+    while (stats_.bytes_resident > budget_ && lru_.size() > 1) {
+        std::map<std::string, Entry>::iterator it = images_.find(lru_.back());
+        stats_.bytes_resident -= it->second.bytes;
+        stats_.evictions++;
+        images_.erase(it);
+        lru_.pop_back();
+    }
+}
+
+void TextureCache::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evict();
+}
+
+TextureCache::Stats TextureCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void TextureCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    images_.clear();
+    lru_.clear();
+    stats_ = Stats();
+}
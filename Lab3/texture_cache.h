@@ -0,0 +1,56 @@
+#ifndef __TEXTURE_CACHE_H__
+#define __TEXTURE_CACHE_H__
+
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "tgaimage.h"
+
+// Process-wide texture store keyed by file path: every model asking for the same file gets the same image.
+// Files are read on the first request, outside the cache lock: other lookups go on meanwhile and only
+// requests for the same file wait for it. When the resident size exceeds the budget, the least recently
+// used images are dropped; callers still holding a shared_ptr keep theirs alive.
+class TextureCache {
+public:
+    struct Stats {
+        int hits;
+        int misses;
+        int failures;
+        int evictions;
+        size_t bytes_resident;
+        double load_ms;
+    };
+
+    static TextureCache& instance();
+
+    // Returns nullptr when the file can't be read. Rows are top to bottom, like the renderer's.
+    std::shared_ptr<TGAImage> get(const std::string& path);
+    void set_budget(size_t bytes);
+    Stats stats();
+    void clear();
+
+private:
+    struct Entry {
+        std::shared_future<std::shared_ptr<TGAImage> > image;  // ready once the file is read
+        size_t bytes;                                          // 0 while loading
+        long load;                                             // which load filled the entry
+        std::list<std::string>::iterator lru;
+    };
+
+    TextureCache();
+    TextureCache(const TextureCache&);
+    TextureCache& operator=(const TextureCache&);
+    void evict();
+
+    std::mutex mutex_;
+    std::map<std::string, Entry> images_;
+    std::list<std::string> lru_;  // most recently used first
+    size_t budget_;
+    long loads_;
+    Stats stats_;
+};
+
+#endif //__TEXTURE_CACHE_H__
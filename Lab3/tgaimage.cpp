@@ -3,19 +3,290 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <algorithm>
 #include "tgaimage.h"
+#include "simd.h"
+#include "thread_pool.h"
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+namespace {
+
+#if defined(LAB3_SIMD_SSSE3)
+// dst[k] = src[map[k]] for 48 bytes, map inside the same 48: every output register is OR-ed from
+// pshufb of the three input registers, each mask zeroing the bytes the register doesn't supply.
+struct Shuffle48 {
+    __m128i mask[3][3];
+    explicit Shuffle48(const unsigned char* map) {
+        for (int o = 0; o < 3; o++) {
+            for (int r = 0; r < 3; r++) {
+                unsigned char m[16];
+                for (int k = 0; k < 16; k++) m[k] = map[o * 16 + k] / 16 == r ? map[o * 16 + k] % 16 : 0x80;
+                mask[o][r] = _mm_loadu_si128((const __m128i*)m);
+            }
+        }
+    }
+    void operator()(const unsigned char* src, unsigned char* dst) const {
+        __m128i in[3] = { _mm_loadu_si128((const __m128i*)src), _mm_loadu_si128((const __m128i*)(src + 16)),
+            _mm_loadu_si128((const __m128i*)(src + 32)) };
+        __m128i out[3];
+        for (int o = 0; o < 3; o++) {
+            out[o] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in[0], mask[o][0]), _mm_shuffle_epi8(in[1], mask[o][1])),
+                _mm_shuffle_epi8(in[2], mask[o][2]));
+        }
+        for (int o = 0; o < 3; o++) _mm_storeu_si128((__m128i*)(dst + o * 16), out[o]);
+    }
+};
+
+// 16 RGB pixels in reverse order.
+const Shuffle48& reverse_rgb16() {
+    static const Shuffle48 shuffle([] {
+        static unsigned char map[48];
+        for (int k = 0; k < 48; k++) map[k] = (unsigned char)((15 - k / 3) * 3 + k % 3);
+        return map;
+    }());
+    return shuffle;
+}
+#endif
+
+#if defined(LAB3_SIMD_AVX) || defined(LAB3_SIMD_SSE2)
+inline __m128i reverse_bytes16(__m128i v) {
+#if defined(LAB3_SIMD_SSSE3)
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+#else
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+#endif
+}
+#endif
+
+void swap_bytes(unsigned char* a, unsigned char* b, size_t n) {
+    size_t i = 0;
+#if defined(LAB3_SIMD_AVX) || defined(LAB3_SIMD_SSE2)
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(a + i), y);
+        _mm_storeu_si128((__m128i*)(b + i), x);
+    }
+#endif
+    for (; i < n; i++) std::swap(a[i], b[i]);
+}
+
+// Reverses the pixel order of one row, working inwards from both ends a block at a time.
+void reverse_row(unsigned char* row, int width, int bpp) {
+    int i = 0, j = width;  // pixels [i, j) are left to do
+#if defined(LAB3_SIMD_AVX) || defined(LAB3_SIMD_SSE2)
+    if (bpp == 4) {
+        for (; j - i >= 8; i += 4, j -= 4) {
+            __m128i l = _mm_loadu_si128((const __m128i*)(row + i * 4));
+            __m128i r = _mm_loadu_si128((const __m128i*)(row + (j - 4) * 4));
+            _mm_storeu_si128((__m128i*)(row + i * 4), _mm_shuffle_epi32(r, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128((__m128i*)(row + (j - 4) * 4), _mm_shuffle_epi32(l, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+    }
+    else if (bpp == 1) {
+        for (; j - i >= 32; i += 16, j -= 16) {
+            __m128i l = _mm_loadu_si128((const __m128i*)(row + i));
+            __m128i r = _mm_loadu_si128((const __m128i*)(row + j - 16));
+            _mm_storeu_si128((__m128i*)(row + i), reverse_bytes16(r));
+            _mm_storeu_si128((__m128i*)(row + j - 16), reverse_bytes16(l));
+        }
+    }
+#if defined(LAB3_SIMD_SSSE3)
+    else if (bpp == 3) {
+        const Shuffle48& reverse = reverse_rgb16();
+        unsigned char l[48];
+        for (; j - i >= 32; i += 16, j -= 16) {
+            memcpy(l, row + i * 3, 48);
+            reverse(row + (j - 16) * 3, row + i * 3);
+            reverse(l, row + (j - 16) * 3);
+        }
+    }
+#endif
+#endif
+    for (j--; i < j; i++, j--) swap_bytes(row + i * bpp, row + j * bpp, bpp);
+}
+
+// Fills n pixels with the bpp-byte pattern by doubling the filled prefix.
+void fill_pixels(unsigned char* dst, int n, const unsigned char* pixel, int bpp) {
+    if (n <= 0) return;
+    if (n < 8) {
+        for (int i = 0; i < n; i++) memcpy(dst + i * bpp, pixel, bpp);
+        return;
+    }
+    if (bpp == 1) {
+        memset(dst, pixel[0], n);
+        return;
+    }
+    size_t total = (size_t)n * bpp;
+    memcpy(dst, pixel, bpp);
+    for (size_t done = bpp; done < total; done *= 2) memcpy(dst + done, dst, std::min(done, total - done));
+}
+
+
+// Literal packets of at most 128 pixels for pixels [from, to).
+unsigned char* emit_literal(const unsigned char* pixels, int from, int to, int bpp, unsigned char* out) {
+    while (from < to) {
+        int k = std::min(128, to - from);
+        *out++ = (unsigned char)(k - 1);
+        memcpy(out, pixels + (size_t)from * bpp, (size_t)k * bpp);
+        out += (size_t)k * bpp;
+        from += k;
+    }
+    return out;
+}
+
+// Upper bound of encode_rle's output for n pixels: a run always saves at least the header of the
+// literal packet resumed after it, so only the literal headers come on top of the raw size.
+size_t rle_bound(int n, int bpp) {
+    return (size_t)n * bpp + n / 128 + 2;
+}
+
+// RLE packets for n pixels, returns the bytes written. A run is cut out of a literal packet only when
+// that is shorter, counting the header needed to resume the literal: two equal RGB pixels are, two
+// equal gray pixels are not.
+template <int Bpp>
+size_t encode_rle(const unsigned char* pixels, int n, unsigned char* out) {
+    const int min_run = Bpp == 1 ? 4 : 2;
+    unsigned char* o = out;
+    int literal = 0;  // first pixel not written yet
+    int i = 0;
+    while (i < n) {
+        const unsigned char* p = pixels + (size_t)i * Bpp;
+        int r = 1;
+        while (i + r < n && r < 128 && !memcmp(p, p + (size_t)r * Bpp, Bpp)) r++;
+        if (r >= min_run) {
+            o = emit_literal(pixels, literal, i, Bpp, o);
+            *o++ = (unsigned char)(127 + r);
+            memcpy(o, p, Bpp);
+            o += Bpp;
+            literal = i + r;
+        }
+        i += r;
+    }
+    o = emit_literal(pixels, literal, n, Bpp, o);
+    return o - out;
+}
+
+struct Band {
+    std::unique_ptr<unsigned char[]> bytes;
+    size_t size;
+};
+
+// A file ready to write: header, the pixel data (the image itself when raw, or one buffer per band
+// of rows) and the trailer, as pieces in file order.
+struct EncodedTGA {
+    TGA_Header header;
+    std::vector<Band> bands;
+    std::vector<std::pair<const unsigned char*, size_t> > pieces;
+};
+
+// developer and extension area offsets (none), then the TGA 2.0 signature
+const unsigned char tga_trailer[26] = { 0, 0, 0, 0, 0, 0, 0, 0,
+    'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+
+// The header holds sizes and the origin as 16-bit unsigned values.
+bool fits_header(int w, int h, int x_origin, int y_origin) {
+    if (w > 0 && h > 0 && w <= 0xffff && h <= 0xffff && x_origin >= 0 && y_origin >= 0 && x_origin <= 0xffff && y_origin <= 0xffff)
+        return true;
+    std::cerr << "a tga file can't be " << w << "x" << h << " at " << x_origin << "," << y_origin << "\n";
+    return false;
+}
+
+void make_header(TGA_Header& header, int w, int h, int bpp, bool rle) {
+    memset((void*)&header, 0, sizeof(header));
+    header.bitsperpixel = bpp << 3;
+    header.width = w;
+    header.height = h;
+    header.datatypecode = (bpp == TGAImage::GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
+    header.imagedescriptor = 0x20; // top-left origin
+}
+
+// RLE bands are encoded independently, on the pool when there is one, so no packet crosses a band.
+void encode_tga(const unsigned char* data, int w, int h, int bpp, bool rle, ThreadPool* pool, int x_origin, int y_origin,
+    EncodedTGA& tga) {
+    make_header(tga.header, w, h, bpp, rle);
+    tga.header.x_origin = (unsigned short)x_origin;
+    tga.header.y_origin = (unsigned short)y_origin;
+    tga.pieces.push_back(std::make_pair((const unsigned char*)&tga.header, sizeof(tga.header)));
+    if (!rle) tga.pieces.push_back(std::make_pair(data, (size_t)w * h * bpp));
+    else {
+        int nbands = pool && pool->size() > 1 ? std::min(h, pool->size() * 4) : 1;
+        // encode_rle counts pixels in an int
+        nbands = std::min(h, std::max(nbands, (int)(((long long)w * h >> 30) + 1)));
+        tga.bands.resize(nbands);
+        // allocated here rather than in the band tasks, so that a failure throws on the caller's thread
+        for (int b = 0; b < nbands; b++) {
+            int y0 = (int)((long long)h * b / nbands), y1 = (int)((long long)h * (b + 1) / nbands);
+            tga.bands[b].bytes.reset(new unsigned char[rle_bound((y1 - y0) * w, bpp)]);
+        }
+        auto encode = [&](int first, int last) {
+            for (int b = first; b < last; b++) {
+                int y0 = (int)((long long)h * b / nbands), y1 = (int)((long long)h * (b + 1) / nbands);
+                int n = (y1 - y0) * w;
+                const unsigned char* pixels = data + (size_t)y0 * w * bpp;
+                Band& band = tga.bands[b];
+                if (bpp == 1) band.size = encode_rle<1>(pixels, n, band.bytes.get());
+                else if (bpp == 3) band.size = encode_rle<3>(pixels, n, band.bytes.get());
+                else band.size = encode_rle<4>(pixels, n, band.bytes.get());
+            }
+        };
+        if (pool && nbands > 1) pool->parallel_for(0, nbands, 1, encode);
+        else encode(0, nbands);
+        for (int b = 0; b < nbands; b++) tga.pieces.push_back(std::make_pair((const unsigned char*)tga.bands[b].bytes.get(), tga.bands[b].size));
+    }
+    tga.pieces.push_back(std::make_pair(tga_trailer, sizeof(tga_trailer)));
+}
+
+#if !defined(_WIN32)
+// writev() until everything is out; a partial write resumes inside the piece it stopped in.
+bool write_pieces(int fd, const std::vector<std::pair<const unsigned char*, size_t> >& pieces) {
+    std::vector<iovec> iov(pieces.size());
+    for (size_t i = 0; i < pieces.size(); i++) {
+        iov[i].iov_base = (void*)pieces[i].first;
+        iov[i].iov_len = pieces[i].second;
+    }
+    size_t next = 0;
+    while (next < iov.size()) {
+        ssize_t n = writev(fd, &iov[next], (int)std::min(iov.size() - next, (size_t)IOV_MAX));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        while (next < iov.size() && (size_t)n >= iov[next].iov_len) n -= iov[next++].iov_len;
+        if (n > 0) {
+            iov[next].iov_base = (char*)iov[next].iov_base + n;
+            iov[next].iov_len -= n;
+        }
+    }
+    return true;
+}
+#endif
+
+}
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
 
 TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
-    unsigned long nbytes = width * height * bytespp;
+    size_t nbytes = (size_t)width * height * bytespp;
     data = new unsigned char[nbytes];
     memset(data, 0, nbytes);
 }
 
 TGAImage::TGAImage(const TGAImage& img) : data(NULL), width(img.width), height(img.height), bytespp(img.bytespp) {
-    unsigned long nbytes = width * height * bytespp;
+    size_t nbytes = (size_t)width * height * bytespp;
     data = new unsigned char[nbytes];
     memcpy(data, img.data, nbytes);
 }
@@ -30,125 +301,147 @@ TGAImage& TGAImage::operator =(const TGAImage& img) {
         width = img.width;
         height = img.height;
         bytespp = img.bytespp;
-        unsigned long nbytes = width * height * bytespp;
+        size_t nbytes = (size_t)width * height * bytespp;
         data = new unsigned char[nbytes];
         memcpy(data, img.data, nbytes);
     }
     return *this;
 }
 
-bool TGAImage::read_tga_file(const char* filename) {
+void TGAImage::swap(TGAImage& img) {
+    std::swap(data, img.data);
+    std::swap(width, img.width);
+    std::swap(height, img.height);
+    std::swap(bytespp, img.bytespp);
+}
+
+// The whole file is read with one call and decoded from memory.
+bool TGAImage::read_tga_file(const char* filename, TGA_Header* header) {
     if (data) delete[] data;
     data = NULL;
     std::ifstream in;
-    in.open(filename, std::ios::binary);
+    in.open(filename, std::ios::binary | std::ios::ate);
     if (!in.is_open()) {
         std::cerr << "can't open file " << filename << "\n";
         in.close();
         return false;
     }
-    TGA_Header header;
-    in.read((char*)&header, sizeof(header));
+    std::streamoff size = in.tellg();
+    in.seekg(0);
+    std::vector<unsigned char> file(size > 0 ? (size_t)size : 0);
+    in.read((char*)file.data(), file.size());
     if (!in.good()) {
         in.close();
+        std::cerr << "an error occured while reading the file\n";
+        return false;
+    }
+    in.close();
+    if (header && file.size() >= sizeof(TGA_Header)) memcpy((void*)header, file.data(), sizeof(TGA_Header));
+    return read_tga(file.data(), file.size());
+}
+
+// Bottom-left files are decoded straight into reversed rows, so no flip pass is needed.
+bool TGAImage::read_tga(const unsigned char* bytes, size_t size) {
+    if (data) delete[] data;
+    data = NULL;
+    TGA_Header header;
+    if (size < sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    memcpy(&header, bytes, sizeof(header));
     width = header.width;
     height = header.height;
     bytespp = header.bitsperpixel >> 3;
     if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
-        in.close();
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
-    unsigned long nbytes = bytespp * width * height;
-    data = new unsigned char[nbytes];
+    // image id and color map (unused) come before the pixels
+    size_t skip = sizeof(header) + (unsigned char)header.idlength;
+    if (header.colormaptype) skip += (size_t)(unsigned short)header.colormaplength * (((unsigned char)header.colormapdepth + 7) / 8);
+    if (skip > size) {
+        std::cerr << "an error occured while reading the header\n";
+        return false;
+    }
+    const unsigned char* in = bytes + skip;
+    const unsigned char* end = bytes + size;
+    bool bottom_up = !(header.imagedescriptor & 0x20);
+    size_t line = (size_t)width * bytespp;
+    // a packet covers at most 128 pixels: reject a truncated file before allocating for it
+    bool rle = 10 == header.datatypecode || 11 == header.datatypecode;
+    if ((size_t)(end - in) < (rle ? (size_t)width * height / 128 * (1 + bytespp) : line * height)) {
+        std::cerr << "an error occured while reading the data\n";
+        return false;
+    }
+    data = new unsigned char[line * height];
+    bool ok;
     if (3 == header.datatypecode || 2 == header.datatypecode) {
-        in.read((char*)data, nbytes);
-        if (!in.good()) {
-            in.close();
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
+        ok = true;
+        for (int y = 0; y < height; y++) memcpy(row(bottom_up ? height - 1 - y : y), in + y * line, line);
     }
-    else if (10 == header.datatypecode || 11 == header.datatypecode) {
-        if (!load_rle_data(in)) {
-            in.close();
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
+    else if (rle) {
+        ok = load_rle_data(in, end, bottom_up);
     }
     else {
-        in.close();
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
-        return false;
+        ok = false;
     }
-    if (!(header.imagedescriptor & 0x20)) {
-        flip_vertically();
+    if (!ok) {
+        std::cerr << "an error occured while reading the data\n";
+        delete[] data;
+        data = NULL;
+        return false;
     }
     if (header.imagedescriptor & 0x10) {
         flip_horizontally();
     }
     std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
-    in.close();
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream& in) {
-    unsigned long pixelcount = width * height;
-    unsigned long currentpixel = 0;
-    unsigned long currentbyte = 0;
-    TGAColor colorbuffer;
-    do {
-        unsigned char chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
+// Packets may span rows; each is split at row ends. Literal packets are one memcpy per row piece,
+// runs a pattern fill. Every packet is checked against the input left and the pixels left.
+bool TGAImage::load_rle_data(const unsigned char* in, const unsigned char* end, bool bottom_up) {
+    int x = 0, y = 0;
+    unsigned long left = (unsigned long)width * height;
+    while (left > 0) {
+        if (in >= end) return false;
+        unsigned char chunkheader = *in++;
+        bool run = chunkheader >= 128;
+        int n = (chunkheader & 127) + 1;
+        size_t need = run ? bytespp : (size_t)n * bytespp;
+        if ((size_t)(end - in) < need) return false;
+        if ((unsigned long)n > left) {
+            std::cerr << "Too many pixels read\n";
             return false;
         }
-        if (chunkheader < 128) {
-            chunkheader++;
-            for (int i = 0; i < chunkheader; i++) {
-                in.read((char*)colorbuffer.bgra, bytespp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
-        }
-        else {
-            chunkheader -= 127;
-            in.read((char*)colorbuffer.bgra, bytespp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
-                return false;
+        const unsigned char* src = in;
+        in += need;
+        left -= n;
+        while (n > 0) {
+            int k = std::min(n, width - x);
+            unsigned char* dst = row(bottom_up ? height - 1 - y : y) + x * bytespp;
+            if (run) fill_pixels(dst, k, src, bytespp);
+            else {
+                memcpy(dst, src, (size_t)k * bytespp);
+                src += (size_t)k * bytespp;
             }
-            for (int i = 0; i < chunkheader; i++) {
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            n -= k;
+            x += k;
+            if (x == width) {
+                x = 0;
+                y++;
             }
         }
-    } while (currentpixel < pixelcount);
+    }
     return true;
 }
 
-bool TGAImage::write_tga_file(const char* filename, bool rle) {
-    unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
-    unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
-    unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+// The whole file goes out with one vectored write.
+bool TGAImage::write_tga_file(const char* filename, bool rle, ThreadPool* pool, int x_origin, int y_origin) {
+    if (!fits_header(width, height, x_origin, y_origin)) return false;
+#if defined(_WIN32)
     std::ofstream out;
     out.open(filename, std::ios::binary);
     if (!out.is_open()) {
@@ -156,91 +449,30 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
         out.close();
         return false;
     }
-    TGA_Header header;
-    memset((void*)&header, 0, sizeof(header));
-    header.bitsperpixel = bytespp << 3;
-    header.width = width;
-    header.height = height;
-    header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
-    header.imagedescriptor = 0x20; // top-left origin
-    out.write((char*)&header, sizeof(header));
-    if (!out.good()) {
-        out.close();
-        std::cerr << "can't dump the tga file\n";
-        return false;
-    }
-    if (!rle) {
-        out.write((char*)data, width * height * bytespp);
-        if (!out.good()) {
-            std::cerr << "can't unload raw data\n";
-            out.close();
-            return false;
-        }
-    }
-    else {
-        if (!unload_rle_data(out)) {
-            out.close();
-            std::cerr << "can't unload rle data\n";
-            return false;
-        }
-    }
-    out.write((char*)developer_area_ref, sizeof(developer_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
-    out.write((char*)extension_area_ref, sizeof(extension_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
-    out.write((char*)footer, sizeof(footer));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
+    bool ok = write_tga(out, rle, pool, x_origin, y_origin);
+    out.close();
+    return ok;
+#else
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "can't open file " << filename << "\n";
         return false;
     }
-    out.close();
-    return true;
+    EncodedTGA tga;
+    encode_tga(data, width, height, bytespp, rle, pool, x_origin, y_origin, tga);
+    bool ok = write_pieces(fd, tga.pieces);
+    if (close(fd) < 0) ok = false;
+    if (!ok) std::cerr << "can't dump the tga file\n";
+    return ok;
+#endif
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream& out) {
-    const unsigned char max_chunk_length = 128;
-    unsigned long npixels = width * height;
-    unsigned long curpix = 0;
-    while (curpix < npixels) {
-        unsigned long chunkstart = curpix * bytespp;
-        unsigned long curbyte = curpix * bytespp;
-        unsigned char run_length = 1;
-        bool raw = true;
-        while (curpix + run_length < npixels && run_length < max_chunk_length) {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bytespp; t++) {
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-            }
-            curbyte += bytespp;
-            if (1 == run_length) {
-                raw = !succ_eq;
-            }
-            if (raw && succ_eq) {
-                run_length--;
-                break;
-            }
-            if (!raw && !succ_eq) {
-                break;
-            }
-            run_length++;
-        }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
-        }
-        out.write((char*)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
+bool TGAImage::write_tga(std::ostream& out, bool rle, ThreadPool* pool, int x_origin, int y_origin) {
+    if (!fits_header(width, height, x_origin, y_origin)) return false;
+    EncodedTGA tga;
+    encode_tga(data, width, height, bytespp, rle, pool, x_origin, y_origin, tga);
+    for (size_t i = 0; i < tga.pieces.size(); i++) {
+        out.write((const char*)tga.pieces[i].first, tga.pieces[i].second);
         if (!out.good()) {
             std::cerr << "can't dump the tga file\n";
             return false;
@@ -253,14 +485,14 @@ TGAColor TGAImage::get(int x, int y) {
     if (!data || x < 0 || y < 0 || x >= width || y >= height) {
         return TGAColor();
     }
-    return TGAColor(data + (x + y * width) * bytespp, bytespp);
+    return TGAColor(data + ((size_t)y * width + x) * bytespp, bytespp);
 }
 
 bool TGAImage::set(int x, int y, TGAColor& c) {
     if (!data || x < 0 || y < 0 || x >= width || y >= height) {
         return false;
     }
-    memcpy(data + (x + y * width) * bytespp, c.bgra, bytespp);
+    memcpy(data + ((size_t)y * width + x) * bytespp, c.bgra, bytespp);
     return true;
 }
 
@@ -268,7 +500,7 @@ bool TGAImage::set(int x, int y, const TGAColor& c) {
     if (!data || x < 0 || y < 0 || x >= width || y >= height) {
         return false;
     }
-    memcpy(data + (x + y * width) * bytespp, c.bgra, bytespp);
+    memcpy(data + ((size_t)y * width + x) * bytespp, c.bgra, bytespp);
     return true;
 }
 
@@ -284,42 +516,177 @@ int TGAImage::get_height() {
     return height;
 }
 
+unsigned char* TGAImage::buffer() {
+    return data;
+}
+
+void TGAImage::clear() {
+    memset((void*)data, 0, (size_t)width * height * bytespp);
+}
+
+unsigned char* TGAImage::row(int y) {
+    if (!data || y < 0 || y >= height) return NULL;
+    return data + (size_t)y * width * bytespp;
+}
+
 bool TGAImage::flip_horizontally() {
     if (!data) return false;
-    int half = width >> 1;
-    for (int i = 0; i < half; i++) {
-        for (int j = 0; j < height; j++) {
-            TGAColor c1 = get(i, j);
-            TGAColor c2 = get(width - 1 - i, j);
-            set(i, j, c2);
-            set(width - 1 - i, j, c1);
-        }
-    }
+    for (int j = 0; j < height; j++) reverse_row(row(j), width, bytespp);
     return true;
 }
 
+// Row pairs are swapped in place, no temporary line.
 bool TGAImage::flip_vertically() {
     if (!data) return false;
-    unsigned long bytes_per_line = width * bytespp;
-    unsigned char* line = new unsigned char[bytes_per_line];
-    int half = height >> 1;
-    for (int j = 0; j < half; j++) {
-        unsigned long l1 = j * bytes_per_line;
-        unsigned long l2 = (height - 1 - j) * bytes_per_line;
-        memmove((void*)line, (void*)(data + l1), bytes_per_line);
-        memmove((void*)(data + l1), (void*)(data + l2), bytes_per_line);
-        memmove((void*)(data + l2), (void*)line, bytes_per_line);
-    }
-    delete[] line;
+    size_t bytes_per_line = (size_t)width * bytespp;
+    for (int j = 0; j < height / 2; j++) swap_bytes(row(j), row(height - 1 - j), bytes_per_line);
     return true;
 }
 
-unsigned char* TGAImage::buffer() {
-    return data;
+void TGAImage::fill(const TGAColor& c) {
+    fill(0, 0, width, height, c);
 }
 
-void TGAImage::clear() {
-    memset((void*)data, 0, width * height * bytespp);
+// The first row of the rectangle is built by pattern doubling, the others are copies of it.
+void TGAImage::fill(int x, int y, int w, int h, const TGAColor& c) {
+    int x0 = std::max(0, x), y0 = std::max(0, y);
+    int x1 = std::min(width, x + w), y1 = std::min(height, y + h);
+    if (!data || x0 >= x1 || y0 >= y1) return;
+    size_t span = (size_t)(x1 - x0) * bytespp;
+    unsigned char* first = row(y0) + x0 * bytespp;
+    fill_pixels(first, x1 - x0, c.bgra, bytespp);
+    for (int j = y0 + 1; j < y1; j++) memcpy(row(j) + x0 * bytespp, first, span);
+}
+
+bool TGAImage::blit(const TGAImage& src, int sx, int sy, int w, int h, int dx, int dy) {
+    if (!data || !src.data || src.bytespp != bytespp) return false;
+    // clip against both images, moving the source and destination corners together
+    if (sx < 0) { w += sx; dx -= sx; sx = 0; }
+    if (sy < 0) { h += sy; dy -= sy; sy = 0; }
+    if (dx < 0) { w += dx; sx -= dx; dx = 0; }
+    if (dy < 0) { h += dy; sy -= dy; dy = 0; }
+    w = std::min(w, std::min(src.width - sx, width - dx));
+    h = std::min(h, std::min(src.height - sy, height - dy));
+    if (w <= 0 || h <= 0) return true;
+    size_t span = (size_t)w * bytespp;
+    // within one image, rows are copied from the side that isn't overwritten first
+    bool up = &src == this && dy > sy;
+    for (int k = 0; k < h; k++) {
+        int j = up ? h - 1 - k : k;
+        memmove(data + ((size_t)(dy + j) * width + dx) * bytespp, src.data + ((size_t)(sy + j) * src.width + sx) * bytespp, span);
+    }
+    return true;
+}
+
+bool TGAImage::swizzle(const int* order) {
+    if (!data) return false;
+    for (int c = 0; c < bytespp; c++) {
+        if (order[c] < 0 || order[c] >= bytespp) return false;
+    }
+    size_t npixels = (size_t)width * height;
+    size_t i = 0;
+#if defined(LAB3_SIMD_SSSE3)
+    if (bytespp == 4) {
+        unsigned char m[16];
+        for (int k = 0; k < 16; k++) m[k] = (unsigned char)(k / 4 * 4 + order[k % 4]);
+        __m128i mask = _mm_loadu_si128((const __m128i*)m);
+        for (; i + 4 <= npixels; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 4));
+            _mm_storeu_si128((__m128i*)(data + i * 4), _mm_shuffle_epi8(v, mask));
+        }
+    }
+    else if (bytespp == 3) {
+        unsigned char map[48];
+        for (int k = 0; k < 48; k++) map[k] = (unsigned char)(k / 3 * 3 + order[k % 3]);
+        Shuffle48 shuffle(map);
+        for (; i + 16 <= npixels; i += 16) shuffle(data + i * 3, data + i * 3);
+    }
+#endif
+    for (; i < npixels; i++) {
+        unsigned char* p = data + i * bytespp;
+        unsigned char t[4];
+        memcpy(t, p, bytespp);
+        for (int c = 0; c < bytespp; c++) p[c] = t[order[c]];
+    }
+    return true;
+}
+
+// Gray to color replicates the value, color to gray takes the Rec. 601 luma; a new alpha is opaque.
+bool TGAImage::convert(Format format) {
+    int bpp = (int)format;
+    if (!data) return false;
+    if (bpp == bytespp) return true;
+    size_t npixels = (size_t)width * height;
+    unsigned char* out = new unsigned char[npixels * bpp];
+    size_t i = 0;
+    if (bytespp == RGB && bpp == RGBA) {
+#if defined(LAB3_SIMD_SSSE3)
+        __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        __m128i alpha = _mm_set1_epi32((int)0xff000000);
+        // 16-byte loads of 12-byte groups, so stop while a full load still fits
+        for (; (i + 4) * 3 + 4 <= npixels * 3; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 3));
+            _mm_storeu_si128((__m128i*)(out + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, expand), alpha));
+        }
+#endif
+        for (; i < npixels; i++) {
+            memcpy(out + i * 4, data + i * 3, 3);
+            out[i * 4 + 3] = 255;
+        }
+    }
+    else if (bytespp == RGBA && bpp == RGB) {
+#if defined(LAB3_SIMD_SSSE3)
+        __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        // 16-byte stores of 12-byte groups, the next group overwrites the tail
+        for (; (i + 4) * 3 + 4 <= npixels * 3; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 4));
+            _mm_storeu_si128((__m128i*)(out + i * 3), _mm_shuffle_epi8(v, pack));
+        }
+#endif
+        for (; i < npixels; i++) memcpy(out + i * 3, data + i * 4, 3);
+    }
+    else if (bytespp == GRAYSCALE) {
+#if defined(LAB3_SIMD_SSSE3)
+        if (bpp == RGBA) {
+            __m128i alpha = _mm_set1_epi32((int)0xff000000);
+            for (; i + 16 <= npixels; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+                for (int q = 0; q < 4; q++) {
+                    __m128i spread = _mm_setr_epi8(q * 4, q * 4, q * 4, -1, q * 4 + 1, q * 4 + 1, q * 4 + 1, -1,
+                        q * 4 + 2, q * 4 + 2, q * 4 + 2, -1, q * 4 + 3, q * 4 + 3, q * 4 + 3, -1);
+                    _mm_storeu_si128((__m128i*)(out + (i + q * 4) * 4), _mm_or_si128(_mm_shuffle_epi8(v, spread), alpha));
+                }
+            }
+        }
+        else {
+            __m128i spread[3];
+            for (int o = 0; o < 3; o++) {
+                unsigned char m[16];
+                for (int k = 0; k < 16; k++) m[k] = (unsigned char)((o * 16 + k) / 3);
+                spread[o] = _mm_loadu_si128((const __m128i*)m);
+            }
+            for (; i + 16 <= npixels; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+                for (int o = 0; o < 3; o++) _mm_storeu_si128((__m128i*)(out + i * 3 + o * 16), _mm_shuffle_epi8(v, spread[o]));
+            }
+        }
+#endif
+        for (; i < npixels; i++) {
+            memset(out + i * bpp, data[i], 3);
+            if (bpp == RGBA) out[i * 4 + 3] = 255;
+        }
+    }
+    else {
+        // bgra in memory: 29 B + 150 G + 77 R, sums to 256
+        for (; i < npixels; i++) {
+            const unsigned char* p = data + i * bytespp;
+            out[i] = (unsigned char)((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8);
+        }
+    }
+    delete[] data;
+    data = out;
+    bytespp = bpp;
+    return true;
 }
 
 bool TGAImage::scale(int w, int h) {
@@ -358,3 +725,49 @@ bool TGAImage::scale(int w, int h) {
     height = h;
     return true;
 }
+
+TGARegionWriter::TGARegionWriter() : out_(), width_(0), height_(0), bytespp_(0), ok_(false) {}
+
+TGARegionWriter::~TGARegionWriter() {
+    if (out_.is_open()) close();
+}
+
+bool TGARegionWriter::open(const char* filename, int width, int height, int bpp) {
+    if (!fits_header(width, height, 0, 0)) return false;
+    out_.open(filename, std::ios::binary);
+    if (!out_.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    width_ = width;
+    height_ = height;
+    bytespp_ = bpp;
+    TGA_Header header;
+    make_header(header, width, height, bpp, false);
+    out_.write((const char*)&header, sizeof(header));
+    ok_ = out_.good();
+    return ok_;
+}
+
+bool TGARegionWriter::write(TGAImage& image, int x, int y) {
+    if (!ok_ || image.get_bytespp() != bytespp_ || x < 0 || y < 0 || x + image.get_width() > width_ || y + image.get_height() > height_)
+        return false;
+    size_t line = (size_t)image.get_width() * bytespp_;
+    for (int j = 0; j < image.get_height(); j++) {
+        out_.seekp(sizeof(TGA_Header) + ((unsigned long long)(y + j) * width_ + x) * bytespp_);
+        out_.write((const char*)image.row(j), line);
+    }
+    ok_ = out_.good();
+    if (!ok_) std::cerr << "can't dump the tga file\n";
+    return ok_;
+}
+
+bool TGARegionWriter::close() {
+    if (ok_) {
+        out_.seekp(sizeof(TGA_Header) + (unsigned long long)width_ * height_ * bytespp_);
+        out_.write((const char*)tga_trailer, sizeof(tga_trailer));
+        ok_ = out_.good();
+    }
+    out_.close();
+    return ok_;
+}
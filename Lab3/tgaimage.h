@@ -2,6 +2,9 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <cstddef>
+
+class ThreadPool;
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -11,10 +14,10 @@ struct TGA_Header {
     short colormaporigin;
     short colormaplength;
     char colormapdepth;
-    short x_origin;
-    short y_origin;
-    short width;
-    short height;
+    unsigned short x_origin;
+    unsigned short y_origin;
+    unsigned short width;
+    unsigned short height;
     char  bitsperpixel;
     char  imagedescriptor;
 };
@@ -68,8 +71,7 @@ protected:
     int height;
     int bytespp;
 
-    bool   load_rle_data(std::ifstream& in);
-    bool unload_rle_data(std::ofstream& out);
+    bool   load_rle_data(const unsigned char* in, const unsigned char* end, bool bottom_up);
 public:
     enum Format {
         GRAYSCALE = 1, RGB = 3, RGBA = 4
@@ -78,8 +80,13 @@ public:
     TGAImage();
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage& img);
-    bool read_tga_file(const char* filename);
-    bool write_tga_file(const char* filename, bool rle = true);
+    // `header`, when given, gets the file's header.
+    bool read_tga_file(const char* filename, TGA_Header* header = nullptr);
+    bool read_tga(const unsigned char* bytes, size_t size);  // a whole file in memory
+    // With a pool, RLE data is encoded in bands of rows in parallel. The origin goes into the header's
+    // x_origin / y_origin fields, as the position of a crop in a larger frame.
+    bool write_tga_file(const char* filename, bool rle = true, ThreadPool* pool = nullptr, int x_origin = 0, int y_origin = 0);
+    bool write_tga(std::ostream& out, bool rle = true, ThreadPool* pool = nullptr, int x_origin = 0, int y_origin = 0);
     bool flip_horizontally();
     bool flip_vertically();
     bool scale(int w, int h);
@@ -88,11 +95,42 @@ public:
     bool set(int x, int y, const TGAColor& c);
     ~TGAImage();
     TGAImage& operator =(const TGAImage& img);
+    void swap(TGAImage& img);
     int get_width();
     int get_height();
     int get_bytespp();
     unsigned char* buffer();
     void clear();
+
+    // Bulk operations, vectorized where the format allows. Rectangles are clipped to the image.
+    unsigned char* row(int y);  // width * bytespp contiguous bytes, rows top to bottom
+    void fill(const TGAColor& c);
+    void fill(int x, int y, int w, int h, const TGAColor& c);
+    // Copies a w x h rectangle of `src` (which may be this image) to (dx, dy); formats must match.
+    bool blit(const TGAImage& src, int sx, int sy, int w, int h, int dx, int dy);
+    // Channel c of every pixel becomes channel order[c], channels in memory (bgra) order.
+    bool swizzle(const int* order);
+    bool convert(Format format);
+};
+
+// An uncompressed top-left TGA file written in rectangles, in any order, for images that are never
+// whole in memory. Only the written rectangles take memory, in the caller's images.
+class TGARegionWriter {
+public:
+    TGARegionWriter();
+    ~TGARegionWriter();
+    bool open(const char* filename, int width, int height, int bpp);
+    // Writes all of `image` with its top-left pixel at (x, y); it must fit and have the file's format.
+    bool write(TGAImage& image, int x, int y);
+    // Writes the trailer and closes the file.
+    bool close();
+
+private:
+    std::ofstream out_;
+    int width_;
+    int height_;
+    int bytespp_;
+    bool ok_;
 };
 
 #endif //__IMAGE_H__
\ No newline at end of file
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Either a general task (fn) or a chunk of a parallel_for (range_fn over [first, last), counted down
+// in range->remaining).
+struct Task {
+    ThreadPool* pool;
+    std::atomic<int> refs;
+    std::function<void()> fn;
+    void (*range_fn)(const void* ctx, int first, int last);
+    const void* ctx;
+    int first;
+    int last;
+    ThreadPool::Range* range;
+    std::exception_ptr error;          // thrown by fn, rethrown by wait()
+    std::atomic<int> pending;          // unfinished dependencies, +1 while submit() is still wiring them
+    std::mutex mutex;
+    std::vector<Task*> dependents;     // released when this task finishes, each holds a reference
+    std::atomic<bool> done;
+    Task* next;                        // chains the tasks of one parallel_for before they are pushed
+    explicit Task(ThreadPool* p) : pool(p), refs(0), fn(), range_fn(nullptr), ctx(nullptr), first(0), last(0),
+        range(nullptr), error(), pending(0), mutex(), dependents(), done(false), next(nullptr) {}
+};
+
+TaskHandle::TaskHandle(Task* task) : task_(task) {
+    if (task_) task_->refs++;
+}
+
+TaskHandle::TaskHandle(const TaskHandle& o) : task_(o.task_) {
+    if (task_) task_->refs++;
+}
+
+TaskHandle& TaskHandle::operator=(const TaskHandle& o) {
+    if (o.task_) o.task_->refs++;
+    if (task_) task_->pool->release(task_);
+    task_ = o.task_;
+    return *this;
+}
+
+TaskHandle::~TaskHandle() {
+    if (task_) task_->pool->release(task_);
+}
+
+namespace {
+
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local int current_index = 0;
+
+void pin_current_thread(int core) {
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+}
+
+}
+
+ThreadPool::ThreadPool(int nthreads, bool pin) : queues_(), workers_(), free_mutex_(), free_(), all_(), sleep_mutex_(), wake_(),
+    queued_(0), waiting_(0), stop_(false) {
+    if (nthreads <= 0) nthreads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < nthreads; i++) queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+    for (int i = 1; i < nthreads; i++) workers_.push_back(std::thread(&ThreadPool::worker, this, i, pin));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) workers_[i].join();
+    for (size_t i = 0; i < all_.size(); i++) delete all_[i];
+}
+
+int ThreadPool::thread_index() const {
+    return current_pool == this ? current_index : 0;
+}
+
+void ThreadPool::worker(int index, bool pin) {
+    current_pool = this;
+    current_index = index;
+    if (pin) pin_current_thread(index);
+    for (;;) {
+        Task* task = pop(index);
+        if (task) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_) return;
+    }
+}
+
+// A task with one reference, owned by the caller.
+Task* ThreadPool::acquire() {
+    Task* task = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(free_mutex_);
+        if (!free_.empty()) {
+            task = free_.back();
+            free_.pop_back();
+        }
+        else {
+            task = new Task(this);
+            all_.push_back(task);
+            if (free_.capacity() < all_.size()) free_.reserve(all_.size() * 2);
+        }
+    }
+    task->refs = 1;
+    task->pending = 0;
+    task->done = false;
+    return task;
+}
+
+void ThreadPool::release(Task* task) {
+    if (--task->refs > 0) return;
+    task->fn = nullptr;
+    task->range_fn = nullptr;
+    task->error = nullptr;
+    task->dependents.clear();
+    std::lock_guard<std::mutex> lock(free_mutex_);
+    free_.push_back(task);
+}
+
+TaskHandle ThreadPool::submit(std::function<void()> fn, const std::vector<TaskHandle>& deps) {
+    Task* task = acquire();
+    task->fn = std::move(fn);
+    task->pending = 1;
+    for (size_t i = 0; i < deps.size(); i++) {
+        Task* dep = deps[i].get();
+        std::lock_guard<std::mutex> lock(dep->mutex);
+        if (dep->done) continue;
+        task->pending++;
+        task->refs++;
+        dep->dependents.push_back(task);
+    }
+    TaskHandle handle(task);
+    if (--task->pending == 0) push(task);
+    else release(task);
+    return handle;
+}
+
+// Makes room for `n` more tasks in the calling thread's queue.
+void ThreadPool::reserve(size_t n) {
+    Queue& q = *queues_[thread_index()];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    reserve_locked(q, q.count + n);
+}
+
+void ThreadPool::reserve_locked(Queue& q, size_t size) {
+    if (size <= q.ring.size()) return;
+    size_t capacity = q.ring.size();
+    while (capacity < size) capacity *= 2;
+    std::vector<Task*> grown(capacity);
+    for (size_t i = 0; i < q.count; i++) grown[i] = q.ring[(q.head + i) % q.ring.size()];
+    q.ring.swap(grown);
+    q.head = 0;
+}
+
+// Takes over the caller's reference.
+void ThreadPool::push(Task* task) {
+    Queue& q = *queues_[thread_index()];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        reserve_locked(q, q.count + 1);
+        q.ring[(q.head + q.count++) % q.ring.size()] = task;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        queued_++;
+    }
+    wake_.notify_one();
+}
+
+Task* ThreadPool::pop(int self) {
+    int n = (int)queues_.size();
+    for (int k = 0; k < n; k++) {
+        Queue& q = *queues_[(self + k) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.count) continue;
+        Task* task;
+        if (k == 0) {
+            task = q.ring[(q.head + q.count - 1) % q.ring.size()];
+        }
+        else {
+            task = q.ring[q.head];
+            q.head = (q.head + 1) % q.ring.size();
+        }
+        q.count--;
+        queued_--;
+        return task;
+    }
+    return nullptr;
+}
+
+// Runs a popped task and drops the queue's reference to it.
+void ThreadPool::run(Task* task) {
+    if (task->range_fn) {
+        // back in the free list before parallel_for() can return, so the next one finds it there
+        Range* range = task->range;
+        try {
+            if (!range->failed) task->range_fn(task->ctx, task->first, task->last);
+        }
+        catch (...) {
+            if (!range->failed.exchange(true)) range->error = std::current_exception();
+        }
+        release(task);
+        // only the last chunk can end the wait; `range` may be gone once remaining reaches 0
+        if (range->remaining.fetch_sub(1) == 1 && waiting_ > 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            wake_.notify_all();
+        }
+        return;
+    }
+    try {
+        task->fn();
+    }
+    catch (...) {
+        task->error = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->done = true;
+    }
+    for (size_t i = 0; i < task->dependents.size(); i++) {
+        Task* next = task->dependents[i];
+        if (--next->pending == 0) push(next);
+        else release(next);
+    }
+    task->dependents.clear();
+    if (waiting_ > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        wake_.notify_all();
+    }
+    release(task);
+}
+
+template <class Done>
+void ThreadPool::help_until(Done done) {
+    int self = thread_index();
+    while (!done()) {
+        Task* next = pop(self);
+        if (next) {
+            run(next);
+            continue;
+        }
+        // nothing to help with: the work is running elsewhere or waits for a running dependency. Sleeps
+        // until a task is queued or one finishes while someone waits, both notify under sleep_mutex_;
+        // waiting_ is raised before done() is checked again, so a finish can't slip in between unseen
+        waiting_++;
+        {
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            wake_.wait(lock, [this, &done] { return queued_ > 0 || done(); });
+        }
+        waiting_--;
+    }
+}
+
+void ThreadPool::wait(const TaskHandle& task) {
+    Task* t = task.get();
+    help_until([t] { return t->done.load(); });
+    if (t->error) std::rethrow_exception(t->error);
+}
+
+void ThreadPool::wait(const std::vector<TaskHandle>& tasks) {
+    for (size_t i = 0; i < tasks.size(); i++) wait(tasks[i]);
+}
+
+void ThreadPool::parallel_for(int begin, int end, int grain, RangeFn fn, const void* ctx) {
+    if (end <= begin) return;
+    grain = std::max(1, grain);
+    if (size() == 1 || end - begin <= grain) {
+        fn(ctx, begin, end);
+        return;
+    }
+    // all tasks and queue slots are taken before the first task can finish, so however the chunks get
+    // scheduled, a parallel_for needs the same resources and a repeat never allocates
+    int n = (end - begin + grain - 1) / grain;
+    reserve(n);
+    Task* chain = nullptr;
+    for (int k = 0; k < n; k++) {
+        Task* task = acquire();
+        task->next = chain;
+        chain = task;
+    }
+    Range range(n);
+    for (int first = begin; first < end; first += grain) {
+        Task* task = chain;
+        chain = task->next;
+        task->range_fn = fn;
+        task->ctx = ctx;
+        task->first = first;
+        task->last = std::min(end, first + grain);
+        task->range = &range;
+        push(task);
+    }
+    help_until([&range] { return range.remaining.load() == 0; });
+    if (range.error) std::rethrow_exception(range.error);
+}
@@ -0,0 +1,107 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+struct Task;
+class ThreadPool;
+
+// Reference to a submitted task; the task object is recycled by the pool once no handle is left.
+class TaskHandle {
+public:
+    TaskHandle() : task_(nullptr) {}
+    explicit TaskHandle(Task* task);
+    TaskHandle(const TaskHandle& o);
+    TaskHandle& operator=(const TaskHandle& o);
+    ~TaskHandle();
+    Task* get() const { return task_; }
+    explicit operator bool() const { return task_ != nullptr; }
+private:
+    Task* task_;
+};
+
+// Work-stealing scheduler. Every thread owns a deque: it pushes and pops its own tasks at the back
+// and steals from the front of the others' when it runs dry. A pool of N threads starts N-1 workers,
+// the thread calling wait() or parallel_for() is the N-th and runs tasks while it waits, so a pool of
+// one runs everything inline on the caller.
+// Task objects and queue storage are reused, so once warmed up parallel_for() doesn't allocate;
+// submit() allocates only if `fn` doesn't fit std::function's inline buffer.
+// An exception thrown by a task is rethrown by wait() on it, or by parallel_for() once all its chunks
+// are done (the first one, chunks not started yet are skipped).
+class ThreadPool {
+public:
+    // 0 threads means one per hardware thread. With `pin`, worker i is bound to core i.
+    explicit ThreadPool(int nthreads = 0, bool pin = false);
+    ~ThreadPool();
+    int size() const { return (int)queues_.size(); }
+    // Index of the calling thread in [0, size()); threads outside the pool are 0.
+    int thread_index() const;
+
+    // `fn` runs once every task in `deps` has finished. Handles of finished tasks are fine as deps.
+    TaskHandle submit(std::function<void()> fn, const std::vector<TaskHandle>& deps = std::vector<TaskHandle>());
+    void wait(const TaskHandle& task);
+    void wait(const std::vector<TaskHandle>& tasks);
+
+    // Calls fn(first, last) on consecutive subranges of [begin, end) of about `grain` items and returns
+    // when all are done.
+    template <class F>
+    void parallel_for(int begin, int end, int grain, const F& fn) {
+        parallel_for(begin, end, grain, &call_range<F>, &fn);
+    }
+
+private:
+    friend class TaskHandle;
+    friend struct Task;
+    typedef void (*RangeFn)(const void* ctx, int first, int last);
+
+    // Shared by the chunks of one parallel_for, on the caller's stack.
+    struct Range {
+        std::atomic<int> remaining;
+        std::atomic<bool> failed;
+        std::exception_ptr error;  // set by the first chunk that threw
+        explicit Range(int n) : remaining(n), failed(false), error() {}
+    };
+
+    // Ring buffer of tasks, grown when full and never shrunk.
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Task*> ring;
+        size_t head;
+        size_t count;
+        Queue() : mutex(), ring(64), head(0), count(0) {}
+    };
+
+    template <class F>
+    static void call_range(const void* ctx, int first, int last) { (*(const F*)ctx)(first, last); }
+    void parallel_for(int begin, int end, int grain, RangeFn fn, const void* ctx);
+
+    void worker(int index, bool pin);
+    Task* acquire();
+    void release(Task* task);
+    void reserve(size_t n);
+    void reserve_locked(Queue& q, size_t size);
+    void push(Task* task);
+    Task* pop(int self);
+    void run(Task* task);
+    template <class Done> void help_until(Done done);
+
+    std::vector<std::unique_ptr<Queue> > queues_;  // queues_[0] belongs to the threads outside the pool
+    std::vector<std::thread> workers_;
+    std::mutex free_mutex_;
+    std::vector<Task*> free_;
+    std::vector<Task*> all_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<int> queued_;
+    std::atomic<int> waiting_;
+    bool stop_;
+};
+
+#endif //__THREAD_POOL_H__
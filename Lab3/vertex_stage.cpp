@@ -0,0 +1,25 @@
+#include <algorithm>
+#include "vertex_stage.h"
+
+namespace {
+
+// Faces per task; smaller chunks cost more in scheduling than they gain in balance.
+const int chunk = 4096;
+
+}
+
+void run_vertex_stage(const IShader& shader, const std::vector<MaterialRange>& ranges, Varyings* out, ThreadPool& pool) {
+    if (ranges.empty()) return;
+    int begin = ranges.front().first;
+    int end = ranges.back().first + ranges.back().count;
+    pool.parallel_for(begin, end, chunk, [&](int first, int last) {
+        for (size_t r = 0; r < ranges.size(); r++) {
+            int lo = std::max(first, ranges[r].first);
+            int hi = std::min(last, ranges[r].first + ranges[r].count);
+            for (int i = lo; i < hi; i++) {
+                for (int j = 0; j < 3; j++) shader.vertex(i, j, out[i]);
+                out[i].material = ranges[r].material;
+            }
+        }
+    });
+}
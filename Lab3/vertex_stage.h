@@ -0,0 +1,14 @@
+#ifndef __VERTEX_STAGE_H__
+#define __VERTEX_STAGE_H__
+
+#include <vector>
+#include "model.h"
+#include "shader.h"
+#include "thread_pool.h"
+
+// Runs shader.vertex() for every face of `ranges` into out[iface] and tags it with the range's
+// material, in chunks spread over the pool. `out` must hold the last face of the last range;
+// rasterization reads it afterwards.
+void run_vertex_stage(const IShader& shader, const std::vector<MaterialRange>& ranges, Varyings* out, ThreadPool& pool);
+
+#endif //__VERTEX_STAGE_H__
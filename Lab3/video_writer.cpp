@@ -0,0 +1,283 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include "video_writer.h"
+#include "simd.h"
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+namespace {
+
+// Rec. 601 full range in 8-bit fixed point (bgr order, like the pixels). The chroma weights sum to
+// zero, so gray maps to 128, and the offset keeps every sum positive before the shift.
+inline unsigned char luma(int b, int g, int r) { return (unsigned char)((29 * b + 150 * g + 77 * r + 128) >> 8); }
+inline unsigned char chroma_u(int b, int g, int r) { return (unsigned char)((127 * b - 84 * g - 43 * r + 32896) >> 8); }
+inline unsigned char chroma_v(int b, int g, int r) { return (unsigned char)((-21 * b - 106 * g + 127 * r + 32896) >> 8); }
+
+// Two rows of output from pixel x on: luma of both rows (y1 null when row1 repeats row0 at the
+// bottom of an odd height) and chroma of the 2x2 blocks.
+void yuv_rows(const unsigned char* row0, const unsigned char* row1, int w, int bpp, int x,
+    unsigned char* y0, unsigned char* y1, unsigned char* u, unsigned char* v) {
+    int ig = bpp >= 3 ? 1 : 0, ir = bpp >= 3 ? 2 : 0;
+    for (; x < w; x += 2) {
+        int x1 = std::min(x + 1, w - 1);
+        const unsigned char* p[4] = { row0 + x * bpp, row0 + x1 * bpp, row1 + x * bpp, row1 + x1 * bpp };
+        y0[x] = luma(p[0][0], p[0][ig], p[0][ir]);
+        if (x + 1 < w) y0[x + 1] = luma(p[1][0], p[1][ig], p[1][ir]);
+        if (y1) {
+            y1[x] = luma(p[2][0], p[2][ig], p[2][ir]);
+            if (x + 1 < w) y1[x + 1] = luma(p[3][0], p[3][ig], p[3][ir]);
+        }
+        int b = 0, g = 0, r = 0;
+        for (int k = 0; k < 4; k++) {
+            b += p[k][0];
+            g += p[k][ig];
+            r += p[k][ir];
+        }
+        b = (b + 2) >> 2;
+        g = (g + 2) >> 2;
+        r = (r + 2) >> 2;
+        u[x / 2] = chroma_u(b, g, r);
+        v[x / 2] = chroma_v(b, g, r);
+    }
+}
+
+#if defined(LAB3_SIMD_SSSE3)
+// 8 bgr or bgra pixels as 16-bit b, g, r lanes.
+inline void load8(const unsigned char* p, int bpp, __m128i& b, __m128i& g, __m128i& r) {
+    const char z = -1;
+    if (bpp == 3) {
+        // 24 bytes: 16 + 8, the last two pixels come from the second load
+        __m128i lo = _mm_loadu_si128((const __m128i*)p);
+        __m128i hi = _mm_loadl_epi64((const __m128i*)(p + 16));
+        b = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_setr_epi8(0, z, 3, z, 6, z, 9, z, 12, z, 15, z, z, z, z, z)),
+            _mm_shuffle_epi8(hi, _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, z, z, 2, z, 5, z)));
+        g = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_setr_epi8(1, z, 4, z, 7, z, 10, z, 13, z, z, z, z, z, z, z)),
+            _mm_shuffle_epi8(hi, _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, 0, z, 3, z, 6, z)));
+        r = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_setr_epi8(2, z, 5, z, 8, z, 11, z, 14, z, z, z, z, z, z, z)),
+            _mm_shuffle_epi8(hi, _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, 1, z, 4, z, 7, z)));
+    }
+    else {
+        __m128i lo = _mm_loadu_si128((const __m128i*)p);
+        __m128i hi = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i* out[3] = { &b, &g, &r };
+        for (int c = 0; c < 3; c++) {
+            char k = (char)c;
+            *out[c] = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_setr_epi8(k, z, k + 4, z, k + 8, z, k + 12, z, z, z, z, z, z, z, z, z)),
+                _mm_shuffle_epi8(hi, _mm_setr_epi8(z, z, z, z, z, z, z, z, k, z, k + 4, z, k + 8, z, k + 12, z)));
+        }
+    }
+}
+
+// Weighted sum plus offset, shifted down: the unsigned 16-bit arithmetic wraps only in intermediate
+// sums whose final value is in range.
+inline __m128i weigh8(__m128i b, __m128i g, __m128i r, short wb, short wg, short wr, short offset) {
+    __m128i s = _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(wb)), _mm_mullo_epi16(g, _mm_set1_epi16(wg)));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(r, _mm_set1_epi16(wr)));
+    return _mm_srli_epi16(_mm_add_epi16(s, _mm_set1_epi16(offset)), 8);
+}
+
+inline __m128i luma8(__m128i b, __m128i g, __m128i r) {
+    return weigh8(b, g, r, 29, 150, 77, 128);
+}
+
+// Averages of horizontal pairs of the row sums of px 0-7 (lo) and 8-15 (hi): 8 lanes of 2x2 blocks.
+inline __m128i average_blocks(__m128i lo0, __m128i hi0, __m128i lo1, __m128i hi1) {
+    __m128i s = _mm_hadd_epi16(_mm_add_epi16(lo0, lo1), _mm_add_epi16(hi0, hi1));
+    return _mm_srli_epi16(_mm_add_epi16(s, _mm_set1_epi16(2)), 2);
+}
+
+// 16 pixels of two rows per step; returns where the scalar tail starts.
+int yuv_rows_simd(const unsigned char* row0, const unsigned char* row1, int w, int bpp,
+    unsigned char* y0, unsigned char* y1, unsigned char* u, unsigned char* v) {
+    if (bpp != 3 && bpp != 4) return 0;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i b[2][2], g[2][2], r[2][2];  // [row][half]
+        for (int half = 0; half < 2; half++) {
+            load8(row0 + (x + half * 8) * bpp, bpp, b[0][half], g[0][half], r[0][half]);
+            load8(row1 + (x + half * 8) * bpp, bpp, b[1][half], g[1][half], r[1][half]);
+        }
+        _mm_storeu_si128((__m128i*)(y0 + x), _mm_packus_epi16(luma8(b[0][0], g[0][0], r[0][0]), luma8(b[0][1], g[0][1], r[0][1])));
+        if (y1) _mm_storeu_si128((__m128i*)(y1 + x), _mm_packus_epi16(luma8(b[1][0], g[1][0], r[1][0]), luma8(b[1][1], g[1][1], r[1][1])));
+        __m128i ab = average_blocks(b[0][0], b[0][1], b[1][0], b[1][1]);
+        __m128i ag = average_blocks(g[0][0], g[0][1], g[1][0], g[1][1]);
+        __m128i ar = average_blocks(r[0][0], r[0][1], r[1][0], r[1][1]);
+        __m128i cu = weigh8(ab, ag, ar, 127, -84, -43, (short)32896);
+        __m128i cv = weigh8(ab, ag, ar, -21, -106, 127, (short)32896);
+        _mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(cu, cu));
+        _mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(cv, cv));
+    }
+    return x;
+}
+#endif
+
+}
+
+void rgb_to_yuv420(TGAImage& image, unsigned char* planes) {
+    int w = image.get_width(), h = image.get_height(), bpp = image.get_bytespp();
+    int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    unsigned char* u = planes + (size_t)w * h;
+    unsigned char* v = u + (size_t)cw * ch;
+    for (int cy = 0; cy < ch; cy++) {
+        int r0 = cy * 2, r1 = std::min(r0 + 1, h - 1);
+        const unsigned char* row0 = image.row(r0);
+        const unsigned char* row1 = image.row(r1);
+        unsigned char* y0 = planes + (size_t)r0 * w;
+        unsigned char* y1 = r1 != r0 ? planes + (size_t)r1 * w : nullptr;
+        int x = 0;
+#if defined(LAB3_SIMD_SSSE3)
+        x = yuv_rows_simd(row0, row1, w, bpp, y0, y1, u + (size_t)cy * cw, v + (size_t)cy * cw);
+#endif
+        yuv_rows(row0, row1, w, bpp, x, y0, y1, u + (size_t)cy * cw, v + (size_t)cy * cw);
+    }
+}
+
+VideoWriter::VideoWriter(int width, int height, Format format, int fps, int depth) : width_(width), height_(height),
+    format_(format), fps_(std::max(1, fps)), depth_(std::max(2, depth)), out_(nullptr), tiles_(), ok_(true), converted_(), frames_(),
+    mutex_(), queued_cv_(), free_cv_(), queued_(), free_(), next_(0), writing_(0), stop_(false), stats_(), thread_() {
+    stats_.frames = stats_.failed = 0;
+    stats_.busy_ms = stats_.stall_ms = 0.;
+    for (int i = 0; i < depth_; i++) {
+        frames_.push_back(std::unique_ptr<Frame>(new Frame()));
+        free_.push_back(frames_.back().get());
+    }
+    thread_ = std::thread(&VideoWriter::writer, this);
+}
+
+VideoWriter::~VideoWriter() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queued_cv_.notify_all();
+    thread_.join();
+}
+
+VideoWriter::Format VideoWriter::format_for(const std::string& path) {
+    if (path == "-") return Y4M;
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0) return Y4M;
+    return path.size() >= 6 && path.compare(path.size() - 6, 6, ".tiles") == 0 ? TILES : RAW_RGB;
+}
+
+bool VideoWriter::open(const std::string& path) {
+    if (path == "-") {
+#if defined(_WIN32)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        out_ = stdout;
+    }
+    else out_ = fopen(path.c_str(), "wb");
+    if (!out_) {
+        std::cerr << "can't open file " << path << std::endl;
+        return false;
+    }
+    if (format_ == Y4M && fprintf(out_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width_, height_, fps_) < 0) ok_ = false;
+    if (format_ == TILES) tiles_.reset(new TileDeltaWriter(out_, width_, height_));
+    return ok_;
+}
+
+void VideoWriter::submit(int index, TGAImage& image) {
+    Frame* frame;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto ready = [&] { return !free_.empty() && index - next_ < depth_ - 1; };
+        if (!ready()) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            free_cv_.wait(lock, ready);
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+            stats_.stall_ms += ms.count();
+        }
+        frame = free_.back();
+        free_.pop_back();
+    }
+    if (frame->image.get_width() != image.get_width() || frame->image.get_height() != image.get_height() ||
+        frame->image.get_bytespp() != image.get_bytespp())
+        frame->image = TGAImage(image.get_width(), image.get_height(), image.get_bytespp());
+    frame->image.swap(image);
+    frame->index = index;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_[index] = frame;
+    }
+    queued_cv_.notify_one();
+}
+
+bool VideoWriter::finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    free_cv_.wait(lock, [this] { return queued_.empty() && writing_ == 0; });
+    if (out_) {
+        if (tiles_ && !tiles_->finish()) ok_ = false;
+        if (fflush(out_) != 0) ok_ = false;
+        if (out_ != stdout && fclose(out_) != 0) ok_ = false;
+        out_ = nullptr;
+    }
+    return ok_ && stats_.failed == 0;
+}
+
+VideoWriter::Stats VideoWriter::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void VideoWriter::writer() {
+    for (;;) {
+        Frame* frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_cv_.wait(lock, [this] { return stop_ || (!queued_.empty() && queued_.begin()->first == next_); });
+            if (queued_.empty() || queued_.begin()->first != next_) return;
+            frame = queued_.begin()->second;
+            queued_.erase(queued_.begin());
+            next_++;
+            writing_++;
+        }
+        free_cv_.notify_all();  // the window moved on
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool ok = write_frame(frame->image);
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writing_--;
+            stats_.frames++;
+            if (!ok) stats_.failed++;
+            stats_.busy_ms += ms.count();
+            free_.push_back(frame);
+        }
+        free_cv_.notify_all();
+    }
+}
+
+// Runs on the writer thread only.
+bool VideoWriter::write_frame(TGAImage& image) {
+    if (!out_ || !ok_) return false;
+    if (image.get_width() != width_ || image.get_height() != height_) {
+        std::cerr << "video frame is " << image.get_width() << "x" << image.get_height() << ", the stream "
+            << width_ << "x" << height_ << std::endl;
+        return false;
+    }
+    bool ok;
+    if (format_ == Y4M) {
+        converted_.resize((size_t)width_ * height_ + 2 * (size_t)((width_ + 1) / 2) * ((height_ + 1) / 2));
+        rgb_to_yuv420(image, converted_.data());
+        ok = fputs("FRAME\n", out_) >= 0 && fwrite(converted_.data(), 1, converted_.size(), out_) == converted_.size();
+    }
+    else if (format_ == TILES) ok = tiles_->add(image);
+    else {
+        // rgb24 rows: drop alpha / expand gray, then bgr -> rgb in place
+        const int bgr_rgb[4] = { 2, 1, 0, 3 };
+        image.convert(TGAImage::RGB);
+        image.swizzle(bgr_rgb);
+        size_t size = (size_t)width_ * height_ * 3;
+        ok = fwrite(image.buffer(), 1, size, out_) == size;
+    }
+    if (!ok) {
+        std::cerr << "can't write the video stream" << std::endl;
+        ok_ = false;
+    }
+    return ok;
+}
@@ -0,0 +1,78 @@
+#ifndef __VIDEO_WRITER_H__
+#define __VIDEO_WRITER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdio>
+#include "tgaimage.h"
+#include "image_writer.h"
+#include "delta_tiles.h"
+
+// Full-range BT.601 4:2:0 planes of `image` (Y, then U, then V, as a Y4M frame stores them). Chroma is
+// taken from the average of each 2x2 block; odd sizes repeat the last row / column. `planes` holds
+// w*h + 2*((w+1)/2)*((h+1)/2) bytes.
+void rgb_to_yuv420(TGAImage& image, unsigned char* planes);
+
+// Streams a sequence of equally sized frames into one file or pipe: YUV4MPEG2 (.y4m, and "-" for
+// stdout), changed tiles only (.tiles, see TileDeltaWriter) or headerless rgb24 rows (anything else).
+// Frames may be submitted out of order from several threads and are written in index order by a
+// background thread that also does the conversion.
+// Buffers are handed over by swapping, like ImageWriter; a frame waits in submit() while it is more
+// than depth - 2 frames ahead of the next one to write, so out-of-order frames can't take every buffer.
+class VideoWriter {
+public:
+    enum Format { Y4M, RAW_RGB, TILES };
+    typedef ImageWriter::Stats Stats;
+
+    VideoWriter(int width, int height, Format format, int fps = 25, int depth = 2);
+    ~VideoWriter();
+    VideoWriter(const VideoWriter&) = delete;
+    VideoWriter& operator=(const VideoWriter&) = delete;
+
+    static Format format_for(const std::string& path);
+    // Opens the output and writes the stream header.
+    bool open(const std::string& path);
+    // Takes the pixels of `image` as frame `index` (0, 1, 2, ... without gaps); `image` gets a buffer of
+    // the same size back, with undefined content.
+    void submit(int index, TGAImage& image);
+    // Waits for everything submitted so far and closes the output; false if any write failed.
+    bool finish();
+    Stats stats();
+
+private:
+    struct Frame {
+        TGAImage image;
+        int index;
+    };
+
+    void writer();
+    bool write_frame(TGAImage& image);
+
+    int width_;
+    int height_;
+    Format format_;
+    int fps_;
+    int depth_;
+    FILE* out_;
+    std::unique_ptr<TileDeltaWriter> tiles_;
+    bool ok_;
+    std::vector<unsigned char> converted_;
+    std::vector<std::unique_ptr<Frame> > frames_;
+    std::mutex mutex_;
+    std::condition_variable queued_cv_;
+    std::condition_variable free_cv_;
+    std::map<int, Frame*> queued_;  // by frame index
+    std::vector<Frame*> free_;
+    int next_;                      // index of the next frame to write
+    int writing_;
+    bool stop_;
+    Stats stats_;
+    std::thread thread_;
+};
+
+#endif //__VIDEO_WRITER_H__